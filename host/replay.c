@@ -0,0 +1,67 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "platform.h"
+#include "video/capture.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Replays a decode unit capture (video_capture, or a decoder history file)
+// into the null or dump video backend, to look at a stream off the device.
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-r] capture [null | dump out.h264]\n", name);
+  fprintf(stderr, "  -r  replay at the recorded pace instead of as fast as possible\n");
+}
+
+int main(int argc, char* argv[]) {
+  bool realtime = false;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-r") == 0) {
+    realtime = true;
+    arg++;
+  }
+  if (arg >= argc) {
+    usage(argv[0]);
+    return 2;
+  }
+  const char* path = argv[arg++];
+
+  PDECODER_RENDERER_CALLBACKS callbacks = &decoder_callbacks_null;
+  void* context = NULL;
+  if (arg < argc && strcmp(argv[arg], "dump") == 0 && arg + 1 < argc) {
+    callbacks = &decoder_callbacks_dump;
+    context = argv[arg + 1];
+  } else if (arg < argc && strcmp(argv[arg], "null") != 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  bool complete;
+  int frames = capture_replay(path, callbacks, context, realtime, &complete);
+  if (frames < 0) {
+    fprintf(stderr, "can't read %s\n", path);
+    return 1;
+  }
+  printf("replayed %d decode units%s\n", frames, complete ? "" : ", capture is incomplete");
+  return complete ? 0 : 1;
+}
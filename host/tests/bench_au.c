@@ -0,0 +1,179 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "video/au.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define ENTRIES 16
+#define ENTRY_SIZE 4096
+#define ROUNDS 20000
+
+static LENTRY entries[ENTRIES];
+static char payload[ENTRIES][ENTRY_SIZE * 16];
+
+// decode unit of count picture buffers of length bytes each
+static DECODE_UNIT make_unit(int count, int length) {
+  DECODE_UNIT unit = {0};
+  for (int i = 0; i < count; i++) {
+    entries[i].data = payload[i];
+    entries[i].length = length;
+    entries[i].bufferType = BUFFER_TYPE_PICDATA;
+    entries[i].next = i + 1 < count ? &entries[i + 1] : NULL;
+  }
+  unit.bufferList = &entries[0];
+  unit.fullLength = count * length;
+  return unit;
+}
+
+static void check_content(const au_frame* frame, int count, int length) {
+  CHECK(frame->length == (uint32_t) (count * length));
+  for (int i = 0; i < count; i++)
+    CHECK(memcmp(frame->data + i * length, payload[i], length) == 0);
+}
+
+// decode unit of a single picture buffer
+static DECODE_UNIT make_picture(const char* data, int length) {
+  DECODE_UNIT unit = {0};
+  entries[0].data = (char*) data;
+  entries[0].length = length;
+  entries[0].bufferType = BUFFER_TYPE_PICDATA;
+  entries[0].next = NULL;
+  unit.bufferList = &entries[0];
+  unit.fullLength = length;
+  return unit;
+}
+
+static void test_slices(void) {
+  // the depacketizer hands a frame's slices over in one buffer; the slice
+  // header starts with first_mb_in_slice 0 and slice_type P (0x98) or B (0xa0)
+  static const char two_slices[] = {
+    0, 0, 0, 1, 0x41, 0x98, 0x12, 0x34,
+    0, 0, 1, 0x06, 0x05, 0x01, 0x80,
+    0, 0, 1, 0x41, 0xa0, 0x56, 0x78,
+  };
+  DECODE_UNIT unit = make_picture(two_slices, sizeof(two_slices));
+  CHECK(au_count_slices(&unit) == 2);
+  CHECK(!au_is_disposable(&unit));
+
+  static const char idr[] = {
+    0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00, 0x02,
+    0, 0, 0, 1, 0x65, 0x80, 0x11, 0x22,
+    0, 0, 1, 0x65, 0x84, 0x33,
+  };
+  unit = make_picture(idr, sizeof(idr));
+  CHECK(au_count_slices(&unit) == 3);
+
+  // a later slice referenced by other frames makes the whole frame needed
+  static const char mixed[] = {
+    0, 0, 0, 1, 0x01, 0x98, 0x12,
+    0, 0, 1, 0x21, 0xa0, 0x56,
+  };
+  unit = make_picture(mixed, sizeof(mixed));
+  CHECK(au_count_slices(&unit) == 2);
+  CHECK(!au_is_disposable(&unit));
+
+  static const char disposable[] = {
+    0, 0, 0, 1, 0x01, 0x98, 0x12,
+    0, 0, 1, 0x01, 0xa0, 0x56,
+  };
+  unit = make_picture(disposable, sizeof(disposable));
+  CHECK(au_count_slices(&unit) == 2);
+  CHECK(au_is_disposable(&unit));
+}
+
+int main(void) {
+  test_slices();
+
+  uint32_t seed = 1;
+  for (int i = 0; i < ENTRIES; i++)
+    for (size_t j = 0; j < sizeof(payload[i]); j++)
+      payload[i][j] = test_random(&seed);
+
+  au_pool pool;
+  CHECK(au_pool_init(&pool, 3, au_estimate_size(10000, 1280, 720, 60)) == 0);
+  au_frame frame;
+
+  // a single buffer is handed through without a copy
+  DECODE_UNIT unit = make_unit(1, ENTRY_SIZE);
+  CHECK(au_assemble(&pool, &unit, 0, &frame));
+  CHECK(frame.data == payload[0] && frame.slab == NULL);
+  au_frame_release(&pool, &frame);
+
+  // several buffers are gathered into a slab
+  unit = make_unit(ENTRIES, ENTRY_SIZE);
+  CHECK(au_assemble(&pool, &unit, 0, &frame));
+  CHECK(frame.slab != NULL);
+  check_content(&frame, ENTRIES, ENTRY_SIZE);
+
+  // every slab in use
+  au_frame held[3];
+  CHECK(au_assemble(&pool, &unit, 0, &held[0]));
+  CHECK(au_assemble(&pool, &unit, 0, &held[1]));
+  CHECK(!au_assemble(&pool, &unit, 0, &held[2]));
+  au_frame_release(&pool, &held[0]);
+  au_frame_release(&pool, &held[1]);
+  au_frame_release(&pool, &frame);
+
+  // an AU larger than the slabs doesn't fit until they are grown
+  unit = make_unit(ENTRIES, ENTRY_SIZE * 8);
+  CHECK(!au_assemble(&pool, &unit, 0, &frame));
+  CHECK(pool.oversized == 1 && pool.resizes == 0);
+  CHECK(au_pool_maintain(&pool) == 3);
+  CHECK(au_pool_maintain(&pool) == 0);
+  CHECK(au_assemble(&pool, &unit, 0, &frame));
+  check_content(&frame, ENTRIES, ENTRY_SIZE * 8);
+  CHECK(pool.resizes == 3);
+  au_frame_release(&pool, &frame);
+
+  // an AU past the high water mark has the slabs grown ahead of time
+  uint32_t slab_size = pool.slab_size;
+  unit = make_unit(ENTRIES, slab_size * 3 / 4 / ENTRIES + 1);
+  CHECK(au_assemble(&pool, &unit, 0, &frame));
+  CHECK(pool.wanted_size > slab_size);
+  // a slab in use is left alone
+  CHECK(au_pool_maintain(&pool) == 2);
+  au_frame_release(&pool, &frame);
+  CHECK(au_pool_maintain(&pool) == 1);
+  CHECK(pool.slab_size == pool.wanted_size);
+
+  // copy cost of a typical 64 KB frame in 16 buffers
+  unit = make_unit(ENTRIES, ENTRY_SIZE);
+  uint64_t start = test_now_ns();
+  uint64_t cycles = test_cycles();
+  for (int i = 0; i < ROUNDS; i++) {
+    CHECK(au_assemble(&pool, &unit, 0, &frame));
+    au_frame_release(&pool, &frame);
+  }
+  uint64_t elapsed = test_now_ns() - start;
+  cycles = test_cycles() - cycles;
+
+  printf("au_assemble: %d x %d bytes, %" PRIu64 " ns, %" PRIu64 " cycles per AU, %.2f GB/s\n",
+         ENTRIES, ENTRY_SIZE, elapsed / ROUNDS, cycles / ROUNDS,
+         (double) ROUNDS * ENTRIES * ENTRY_SIZE / elapsed);
+  printf("pool: %" PRIu64 " frames, %" PRIu64 " zero copy, %u resizes, largest %u\n",
+         pool.frames, pool.zero_copy_frames, pool.resizes, pool.largest_au);
+
+  au_pool_destroy(&pool);
+  return 0;
+}
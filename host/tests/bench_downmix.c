@@ -0,0 +1,112 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "audio/downmix.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+// one 5 ms Opus frame at 48 kHz
+#define FRAME_SAMPLES 240
+#define MAX_FRAMES 64
+#define ROUNDS 200000
+// written around the output to catch stores past the end
+#define GUARD ((short) 0x5a5a)
+
+static short in[MAX_FRAMES * 6];
+static short out_simd[MAX_FRAMES * 2 + 8];
+static short out_scalar[MAX_FRAMES * 2 + 8];
+
+static void compare(int frames) {
+  for (int i = 0; i < MAX_FRAMES * 2 + 8; i++)
+    out_simd[i] = out_scalar[i] = GUARD;
+  downmix_51_stereo(in, out_simd, frames);
+  downmix_51_stereo_scalar(in, out_scalar, frames);
+  CHECK(memcmp(out_simd, out_scalar, sizeof(out_simd)) == 0);
+  for (int i = frames * 2; i < MAX_FRAMES * 2 + 8; i++)
+    CHECK(out_simd[i] == GUARD);
+}
+
+static void test_equivalence(void) {
+  uint32_t state = 0x2468ace;
+
+  // every frame count, so all the tails of the SIMD loops run
+  for (int round = 0; round < 1000; round++) {
+    for (int i = 0; i < MAX_FRAMES * 6; i++)
+      in[i] = (short) test_random(&state);
+    compare(round % (MAX_FRAMES + 1));
+  }
+
+  // full scale on every channel in both directions, and every mix of the two
+  const short extremes[] = { INT16_MAX, INT16_MIN, 0, -1 };
+  for (int mix = 0; mix < 4 * 4 * 4 * 4 * 4; mix++) {
+    int pick = mix;
+    for (int c = 0; c < 6; c++) {
+      // LFE is dropped, keep it random
+      if (c == 3) {
+        in[c] = (short) test_random(&state);
+        continue;
+      }
+      in[c] = extremes[pick % 4];
+      pick /= 4;
+    }
+    for (int i = 1; i < MAX_FRAMES; i++)
+      memcpy(in + i * 6, in, 6 * sizeof(short));
+    compare(MAX_FRAMES);
+    compare(7);
+  }
+
+  // the gains keep the sum of full scale channels in range
+  for (int i = 0; i < MAX_FRAMES * 6; i++)
+    in[i] = INT16_MAX;
+  compare(MAX_FRAMES);
+  CHECK(out_scalar[0] > 32000 && out_scalar[1] > 32000);
+}
+
+typedef void (*downmix_fn)(const short*, short*, int);
+
+static void time_downmix(const char* name, downmix_fn fn) {
+  static short frame_in[FRAME_SAMPLES * 6], frame_out[FRAME_SAMPLES * 2];
+  uint32_t state = 0x13579bd;
+  for (int i = 0; i < FRAME_SAMPLES * 6; i++)
+    frame_in[i] = (short) test_random(&state);
+
+  uint64_t start = test_now_ns();
+  uint64_t cycles = test_cycles();
+  for (int i = 0; i < ROUNDS; i++) {
+    fn(frame_in, frame_out, FRAME_SAMPLES);
+    // keep the calls from being folded together
+    __asm__ volatile("" : : "r"(frame_out) : "memory");
+  }
+  cycles = test_cycles() - cycles;
+  uint64_t ns = test_now_ns() - start;
+
+  printf("downmix %s: %" PRIu64 " ns, %" PRIu64 " cycles per 5 ms frame\n",
+         name, ns / ROUNDS, cycles / ROUNDS);
+}
+
+int main(void) {
+  test_equivalence();
+  time_downmix("scalar", downmix_51_stereo_scalar);
+  time_downmix("simd", downmix_51_stereo);
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+#include "h264.h"
+
+#include "video/au.h"
+#include "sps.h"
+
+#include "h264_stream.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define ROUNDS 100000
+
+static uint64_t time_fix(LENTRY** sps, int count) {
+  uint8_t out[256];
+  uint64_t start = test_now_ns();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint32_t length = 0;
+    gs_sps_fix(sps[i % count], GS_SPS_BITSTREAM_FIXUP, out, &length);
+  }
+  return (test_now_ns() - start) / ROUNDS;
+}
+
+int main(void) {
+  uint8_t raw_720[256], raw_720_level[256], raw_1080[256];
+  LENTRY sps_720 = { .data = (char*) raw_720, .bufferType = BUFFER_TYPE_SPS };
+  LENTRY sps_720_level = { .data = (char*) raw_720_level, .bufferType = BUFFER_TYPE_SPS };
+  LENTRY sps_1080 = { .data = (char*) raw_1080, .bufferType = BUFFER_TYPE_SPS };
+  sps_720.length = test_make_sps(raw_720, 1280, 720, 51);
+  sps_720_level.length = test_make_sps(raw_720_level, 1280, 720, 40);
+  sps_1080.length = test_make_sps(raw_1080, 1920, 1080, 51);
+
+  gs_sps_init(1280, 720);
+  int width = 0, height = 0;
+
+  // the first SPS of the session only sets the level
+  CHECK(!gs_sps_changed(&sps_720, &width, &height));
+  CHECK(width == 1280 && height == 720);
+  CHECK(!gs_sps_changed(&sps_720, &width, &height));
+
+  // a cached rewrite gives the same bytes as the parsed one
+  uint8_t fixed[256], cached[256];
+  uint32_t fixed_length = 0, cached_length = 0;
+  gs_sps_fix(&sps_720, GS_SPS_BITSTREAM_FIXUP, fixed, &fixed_length);
+  gs_sps_fix(&sps_720, GS_SPS_BITSTREAM_FIXUP, cached, &cached_length);
+  CHECK(fixed_length > 4 && fixed_length == cached_length);
+  CHECK(memcmp(fixed, cached, fixed_length) == 0);
+
+  // the rewrite caps the reference frames and sets the 720p level
+  h264_stream_t* h = h264_new();
+  read_nal_unit(h, fixed + 4, fixed_length - 4);
+  CHECK(h->sps->num_ref_frames == 1 && h->sps->level_idc == 32);
+  CHECK(h->sps->vui.bitstream_restriction_flag && h->sps->vui.max_dec_frame_buffering == 1);
+  h264_free(h);
+
+  // the SPS is the first thing in the assembled AU
+  au_pool pool;
+  CHECK(au_pool_init(&pool, 1, AU_MIN_SLAB_SIZE) == 0);
+  char slice[] = { 0, 0, 0, 1, 0x65, 0x88, 0x84 };
+  LENTRY idr = { .data = slice, .length = sizeof(slice), .bufferType = BUFFER_TYPE_PICDATA };
+  LENTRY sps = sps_720;
+  sps.next = &idr;
+  DECODE_UNIT unit = { .bufferList = &sps, .fullLength = sps.length + idr.length };
+  au_frame frame;
+  CHECK(au_assemble(&pool, &unit, GS_SPS_BITSTREAM_FIXUP, &frame));
+  CHECK(frame.length == fixed_length + sizeof(slice));
+  CHECK(memcmp(frame.data, fixed, fixed_length) == 0);
+  CHECK(memcmp(frame.data + fixed_length, slice, sizeof(slice)) == 0);
+  au_frame_release(&pool, &frame);
+  au_pool_destroy(&pool);
+
+  // level and resolution changes are noticed
+  CHECK(gs_sps_changed(&sps_720_level, &width, &height));
+  CHECK(width == 1280 && height == 720);
+  CHECK(gs_sps_changed(&sps_1080, &width, &height));
+  CHECK(width == 1920 && height == 1080);
+  CHECK(!gs_sps_changed(&sps_1080, &width, &height));
+
+  // the same SPS every IDR hits the cache, alternating ones never do
+  LENTRY* same[] = { &sps_720 };
+  LENTRY* alternating[] = { &sps_720, &sps_720_level };
+  uint64_t hit = time_fix(same, 1);
+  uint64_t miss = time_fix(alternating, 2);
+  printf("gs_sps_fix: %" PRIu64 " ns cached, %" PRIu64 " ns parsed and rewritten\n", hit, miss);
+
+  gs_sps_stop();
+  return 0;
+}
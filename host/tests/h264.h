@@ -0,0 +1,99 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "test.h"
+
+#include <Limelight.h>
+#include "h264_stream.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// Main profile SPS with a start code, as GFE would send it
+static inline int test_make_sps(uint8_t* buf, int width, int height, int level) {
+  h264_stream_t* h = h264_new();
+  h->nal->nal_ref_idc = 3;
+  h->nal->nal_unit_type = NAL_UNIT_TYPE_SPS;
+
+  sps_t* sps = h->sps;
+  sps->profile_idc = 77;
+  sps->level_idc = level;
+  sps->chroma_format_idc = 1;
+  sps->pic_order_cnt_type = 2;
+  sps->num_ref_frames = 4;
+  sps->pic_width_in_mbs_minus1 = (width + 15) / 16 - 1;
+  sps->pic_height_in_map_units_minus1 = (height + 15) / 16 - 1;
+  sps->frame_mbs_only_flag = 1;
+  sps->direct_8x8_inference_flag = 1;
+  sps->frame_cropping_flag = height % 16 != 0;
+  sps->frame_crop_bottom_offset = (16 - height % 16) % 16 / 2;
+  sps->vui_parameters_present_flag = 1;
+  sps->vui.video_signal_type_present_flag = 1;
+  sps->vui.video_format = 5;
+
+  memcpy(buf, "\0\0\0\1", 4);
+  int length = write_nal_unit(h, buf + 4, 128);
+  h264_free(h);
+  CHECK(length > 0);
+  return length + 4;
+}
+
+// Decode unit number n of a 1280x720 test stream: SPS, PPS and an IDR
+// slice for IDR frames, two P slices otherwise. Only valid until the next
+// call.
+static inline PDECODE_UNIT test_stream_unit(int n, bool idr) {
+  static uint8_t sps[256];
+  static char pps[] = { 0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80 };
+  static char slices[2][64];
+  static LENTRY entries[3];
+  static DECODE_UNIT unit;
+
+  memset(entries, 0, sizeof(entries));
+  int count = 0;
+  if (idr) {
+    entries[count].data = (char*) sps;
+    entries[count].length = test_make_sps(sps, 1280, 720, 51);
+    entries[count++].bufferType = BUFFER_TYPE_SPS;
+    entries[count].data = pps;
+    entries[count].length = sizeof(pps);
+    entries[count++].bufferType = BUFFER_TYPE_PPS;
+  }
+  for (int i = 0; i < (idr ? 1 : 2); i++) {
+    // IDR slice, or P slice with nal_ref_idc 2
+    char header[] = { 0, 0, 0, 1, idr ? 0x65 : 0x41, 0x88 + i };
+    memset(slices[i], n + i, sizeof(slices[i]));
+    memcpy(slices[i], header, sizeof(header));
+    entries[count].data = slices[i];
+    entries[count].length = sizeof(slices[i]);
+    entries[count++].bufferType = BUFFER_TYPE_PICDATA;
+  }
+
+  memset(&unit, 0, sizeof(unit));
+  unit.frameNumber = n;
+  unit.receiveTimeMs = 1000 + n * 16;
+  unit.bufferList = &entries[0];
+  for (int i = 0; i < count; i++) {
+    entries[i].next = i + 1 < count ? &entries[i + 1] : NULL;
+    unit.fullLength += entries[i].length;
+  }
+  return &unit;
+}
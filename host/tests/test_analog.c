@@ -0,0 +1,187 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "input/analog.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// full deflection of the 8 bit hardware value, as the input thread scales it
+#define FULL 32640
+
+static void test_deadzone(void) {
+  analog_filter filter;
+  // 10% deadzone, linear
+  analog_filter_init(&filter, 10, 100, 0, 0);
+
+  short x = FULL / 20, y = 0;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(x == 0 && y == 0);
+
+  // the deadzone is round: a diagonal inside it is cut as well, even if
+  // each axis alone is close to the edge
+  x = 2200, y = -2200;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(x == 0 && y == 0);
+
+  // just outside it starts from zero and full deflection stays full scale
+  x = FULL / 10 + 512, y = 0;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(x > 0 && x < 1024 && y == 0);
+  x = 0, y = -FULL;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(x == 0 && y <= -32766);
+
+  // half way out of the deadzone is half way
+  x = FULL / 10 + (FULL - FULL / 10) / 2, y = 0;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(abs(x - 32767 / 2) < 64);
+
+  // no deadzone and linear leaves the stick alone
+  analog_filter_init(&filter, 0, 100, 0, 0);
+  x = 12345, y = -4321;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(abs(x - 12345 * 32767 / FULL) <= 2 && abs(y + 4321 * 32767 / FULL) <= 2);
+}
+
+static void test_curve(void) {
+  analog_filter filter;
+  // no deadzone, quadratic
+  analog_filter_init(&filter, 0, 200, 0, 0);
+
+  CHECK(filter.curve[0] == 0);
+  CHECK(filter.curve[ANALOG_CURVE_SIZE - 2] == 32767);
+  CHECK(filter.curve[ANALOG_CURVE_SIZE - 1] == 32767);
+  for (int i = 1; i < ANALOG_CURVE_SIZE; i++)
+    CHECK(filter.curve[i] >= filter.curve[i - 1]);
+
+  // half deflection comes out at a quarter, a quarter at a sixteenth
+  short x = FULL / 2, y = 0;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(abs(x - 32767 / 4) < 64);
+  x = -FULL / 4, y = 0;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(abs(x + 32767 / 16) < 64);
+
+  // between two table entries it is interpolated
+  x = 100 * 128 + 64, y = 0;
+  analog_filter_stick(&filter, &x, &y);
+  int i = 100;
+  CHECK(x > filter.curve[i] && x < filter.curve[i + 1]);
+
+  // the curve only changes the distance, not the direction
+  x = 10000, y = 10000;
+  analog_filter_stick(&filter, &x, &y);
+  CHECK(x == y && x > 0 && x < 10000);
+}
+
+static void test_threshold(void) {
+  analog_filter filter;
+  // threshold of 2 hardware steps, no rate limit
+  analog_filter_init(&filter, 0, 100, 2, 0);
+  CHECK(filter.threshold[0] == 512 && filter.threshold[ANALOG_AXES - 1] == 2);
+
+  uint64_t now = 1000000;
+  short axes[ANALOG_AXES] = {1000, 0, 0, 0, 0, 0};
+  CHECK(analog_filter_update(&filter, axes, false, now));
+  CHECK(!filter.pending);
+
+  // nothing changed, nothing to send
+  CHECK(!analog_filter_update(&filter, axes, false, now + 1000));
+
+  // a small change is held back until it held for ANALOG_SETTLE
+  axes[0] = 1100;
+  CHECK(!analog_filter_update(&filter, axes, false, now + 2000));
+  CHECK(filter.pending);
+  CHECK(!analog_filter_update(&filter, axes, false, now + 2000 + ANALOG_SETTLE - 1));
+  CHECK(filter.pending && filter.below_threshold == 2);
+  CHECK(analog_filter_update(&filter, axes, false, now + 2000 + ANALOG_SETTLE));
+  CHECK(!filter.pending && filter.sent[0] == 1100);
+
+  // a small change that goes away again is never sent
+  now += 1000000;
+  axes[0] = 1200;
+  CHECK(!analog_filter_update(&filter, axes, false, now));
+  axes[0] = 1100;
+  CHECK(!analog_filter_update(&filter, axes, false, now + 1000));
+  CHECK(!filter.pending);
+  CHECK(!analog_filter_update(&filter, axes, false, now + ANALOG_SETTLE * 2));
+
+  // a change of the threshold or more, going back to zero and a button
+  // change all go out right away
+  axes[0] = 1100 + 512;
+  CHECK(analog_filter_update(&filter, axes, false, now + ANALOG_SETTLE * 3));
+  axes[0] = 0;
+  CHECK(analog_filter_update(&filter, axes, false, now + ANALOG_SETTLE * 4));
+  axes[4] = 1;
+  CHECK(!analog_filter_update(&filter, axes, false, now + ANALOG_SETTLE * 5));
+  CHECK(analog_filter_update(&filter, axes, true, now + ANALOG_SETTLE * 5 + 1));
+
+  // triggers have their own threshold in 8 bit steps
+  axes[4] = 3;
+  CHECK(analog_filter_update(&filter, axes, false, now + ANALOG_SETTLE * 6));
+}
+
+static void test_rate(void) {
+  analog_filter filter;
+  // 100 sends a second at most, no threshold
+  analog_filter_init(&filter, 0, 100, 0, 100);
+  CHECK(filter.interval == 10000);
+
+  // a stick sweeping through sampled at 1 kHz: every change is held back
+  // until 10 ms after the last send, and the last one goes out when it is
+  // over, as the caller keeps asking while pending
+  uint64_t now = 1000000;
+  short axes[ANALOG_AXES] = {0};
+  uint32_t sent = 0;
+  for (int i = 1; i <= 1000; i++) {
+    axes[0] = i * 32;
+    if (analog_filter_update(&filter, axes, false, now + i * 1000))
+      sent++;
+  }
+  CHECK(sent == 100);
+  CHECK(filter.rate_limited == 900);
+  CHECK(filter.pending);
+  CHECK(filter.sent[0] != 32000);
+
+  uint64_t end = now + 1000 * 1000;
+  bool flushed = false;
+  for (uint64_t t = end + 1000; t <= end + 10000 && !flushed; t += 1000)
+    flushed = analog_filter_update(&filter, axes, false, t);
+  CHECK(flushed && !filter.pending && filter.sent[0] == 32000);
+
+  // a forced send isn't held back
+  axes[0] = 100;
+  CHECK(analog_filter_update(&filter, axes, true, end + 10001));
+  axes[0] = 200;
+  CHECK(!analog_filter_update(&filter, axes, false, end + 10002));
+  CHECK(analog_filter_update(&filter, axes, true, end + 10003));
+  CHECK(filter.sends == 100 + 3);
+}
+
+int main(void) {
+  test_deadzone();
+  test_curve();
+  test_threshold();
+  test_rate();
+  return 0;
+}
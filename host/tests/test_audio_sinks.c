@@ -0,0 +1,184 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "audio.h"
+#include "audio/decoder.h"
+
+#include <opus/opus_multistream.h>
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#define PACKET_FRAMES 240
+#define PACKETS 200
+// packets that never arrive, the sinks get NULL in their place
+#define LOST_EVERY 25
+
+static unsigned char packets[PACKETS][1500];
+static int lengths[PACKETS];
+
+// a 440 Hz tone, 5 ms per packet like the host sends it
+static void encode(OPUS_MULTISTREAM_CONFIGURATION* config, int channels) {
+  config->sampleRate = 48000;
+  config->channelCount = channels;
+
+  int rc;
+  OpusMSEncoder* encoder = opus_multistream_surround_encoder_create(
+      48000, channels, channels > 2, &config->streams, &config->coupledStreams, config->mapping,
+      OPUS_APPLICATION_RESTRICTED_LOWDELAY, &rc);
+  CHECK(rc == OPUS_OK);
+
+  short pcm[PACKET_FRAMES * 6];
+  for (int p = 0; p < PACKETS; p++) {
+    for (int i = 0; i < PACKET_FRAMES; i++) {
+      short sample = 8000 * sin(2 * M_PI * 440 * (p * PACKET_FRAMES + i) / 48000);
+      for (int c = 0; c < channels; c++)
+        pcm[i * channels + c] = sample;
+    }
+    lengths[p] = opus_multistream_encode(encoder, pcm, PACKET_FRAMES, packets[p], sizeof(packets[p]));
+    CHECK(lengths[p] > 0);
+  }
+  opus_multistream_encoder_destroy(encoder);
+}
+
+static void feed(PAUDIO_RENDERER_CALLBACKS callbacks, OPUS_MULTISTREAM_CONFIGURATION* config, void* context) {
+  CHECK(callbacks->init(AUDIO_CONFIGURATION_STEREO, config, context, 0) == 0);
+  for (int p = 0; p < PACKETS; p++) {
+    if (p % LOST_EVERY == LOST_EVERY / 2)
+      callbacks->decodeAndPlaySample(NULL, 0);
+    else
+      callbacks->decodeAndPlaySample((char*) packets[p], lengths[p]);
+  }
+  callbacks->cleanup();
+}
+
+static uint32_t get_le(const unsigned char* in, int bytes) {
+  uint32_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+    value = value << 8 | in[i];
+  return value;
+}
+
+static void test_wav(OPUS_MULTISTREAM_CONFIGURATION* config, const char* dir) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/stream.wav", dir);
+
+  // the context is the output path, as set by audio_dump
+  feed(&audio_callbacks_wav, config, path);
+
+  FILE* fd = fopen(path, "rb");
+  CHECK(fd != NULL);
+  unsigned char header[44];
+  CHECK(fread(header, 1, sizeof(header), fd) == sizeof(header));
+  fseek(fd, 0, SEEK_END);
+  long size = ftell(fd);
+  fclose(fd);
+  remove(path);
+
+  CHECK(memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVEfmt ", 8) == 0);
+  CHECK(get_le(header + 22, 2) == 2 && get_le(header + 24, 4) == 48000);
+  CHECK(memcmp(header + 36, "data", 4) == 0);
+  CHECK(get_le(header + 4, 4) == size - 8);
+  // lost packets are made up for, so the audio keeps its length
+  uint32_t data_size = get_le(header + 40, 4);
+  CHECK(data_size == size - sizeof(header));
+  CHECK(data_size == PACKETS * PACKET_FRAMES * 2 * sizeof(short));
+}
+
+static void test_timing(OPUS_MULTISTREAM_CONFIGURATION* config, const char* dir) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/audio_timing.txt", dir);
+
+  // the context is the output path, as set by audio_timing
+  feed(&audio_callbacks_timing, config, path);
+
+  // one line per packet; a lost one decodes nothing, it is made up for and
+  // counted with the packet after it
+  FILE* fd = fopen(path, "r");
+  CHECK(fd != NULL);
+  uint64_t arrival, elapsed, last = 0;
+  uint32_t frames, lost, lines = 0, empty = 0, total = 0;
+  while (fscanf(fd, "%" SCNu64 " %" SCNu64 " %u %u", &arrival, &elapsed, &frames, &lost) == 4) {
+    CHECK(arrival >= last);
+    last = arrival;
+    CHECK(frames == PACKET_FRAMES || (frames == 0 && lost == 0));
+    empty += frames == 0;
+    total += frames + lost;
+    lines++;
+  }
+  fclose(fd);
+  remove(path);
+
+  CHECK(lines == PACKETS && empty == PACKETS / LOST_EVERY);
+  CHECK(total == PACKETS * PACKET_FRAMES);
+}
+
+static uint32_t played, made_up;
+
+static void count_play(void* context, const short* pcm, int frames, bool lost) {
+  (void) context;
+  (void) pcm;
+  played += frames;
+  if (lost)
+    made_up += frames;
+}
+
+static void test_decoder(OPUS_MULTISTREAM_CONFIGURATION* config) {
+  audio_decoder decoder;
+  CHECK(audio_decoder_init(&decoder, config, count_play, NULL, NULL) == 0);
+  played = made_up = 0;
+  for (int p = 0; p < PACKETS; p++) {
+    if (p % LOST_EVERY == LOST_EVERY / 2)
+      audio_decoder_packet(&decoder, NULL, 0);
+    else
+      audio_decoder_packet(&decoder, (char*) packets[p], lengths[p]);
+  }
+  audio_decoder_destroy(&decoder);
+
+  // the encoder runs CELT only, whose packets carry no FEC, so every loss
+  // is concealed even though the packet after it was there
+  CHECK(decoder.packets == PACKETS - PACKETS / LOST_EVERY);
+  CHECK(decoder.concealed == PACKETS / LOST_EVERY && decoder.fec == 0);
+  CHECK(played == PACKETS * PACKET_FRAMES && made_up == PACKETS / LOST_EVERY * PACKET_FRAMES);
+}
+
+int main(void) {
+  char dir[] = "/tmp/moonlight-audio-XXXXXX";
+  CHECK(mkdtemp(dir) != NULL);
+
+  OPUS_MULTISTREAM_CONFIGURATION stereo, surround;
+  encode(&stereo, 2);
+  test_decoder(&stereo);
+  feed(&audio_callbacks_null, &stereo, NULL);
+  test_wav(&stereo, dir);
+  test_timing(&stereo, dir);
+
+  // 5.1 is downmixed on the way
+  encode(&surround, 6);
+  test_decoder(&surround);
+  feed(&audio_callbacks_null, &surround, NULL);
+  test_wav(&surround, dir);
+
+  remove(dir);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+#include "h264.h"
+
+#include "video/capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FRAMES 30
+
+static char path[64];
+static int submitted, setups, cleanups;
+
+static int recorder_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  (void) context;
+  (void) drFlags;
+  CHECK(videoFormat == VIDEO_FORMAT_H264 && width == 1280 && height == 720 && redrawRate == 60);
+  setups++;
+  return 0;
+}
+
+static void recorder_cleanup() {
+  cleanups++;
+}
+
+// every decode unit has to come back exactly as test_stream_unit made it
+static int recorder_submit(PDECODE_UNIT decodeUnit) {
+  submitted++;
+  CHECK(decodeUnit->frameNumber == submitted);
+  uint64_t receive = decodeUnit->receiveTimeMs;
+
+  PDECODE_UNIT expected = test_stream_unit(submitted, submitted == 1);
+  CHECK(receive == expected->receiveTimeMs);
+  CHECK(decodeUnit->fullLength == expected->fullLength);
+  PLENTRY entry = decodeUnit->bufferList, other = expected->bufferList;
+  for (; entry != NULL && other != NULL; entry = entry->next, other = other->next) {
+    CHECK(entry->bufferType == other->bufferType);
+    CHECK(entry->length == other->length);
+    CHECK(memcmp(entry->data, other->data, entry->length) == 0);
+  }
+  CHECK(entry == NULL && other == NULL);
+  return DR_OK;
+}
+
+static DECODER_RENDERER_CALLBACKS recorder = {
+  .setup = recorder_setup,
+  .cleanup = recorder_cleanup,
+  .submitDecodeUnit = recorder_submit,
+};
+
+static long record(void) {
+  submitted = 0;
+  PDECODER_RENDERER_CALLBACKS callbacks = capture_wrap(&recorder, path);
+  CHECK(callbacks->setup(VIDEO_FORMAT_H264, 1280, 720, 60, NULL, 0) == 0);
+  for (int n = 1; n <= FRAMES; n++)
+    CHECK(callbacks->submitDecodeUnit(test_stream_unit(n, n == 1)) == DR_OK);
+  callbacks->cleanup();
+
+  FILE* fd = fopen(path, "rb");
+  CHECK(fd != NULL);
+  fseek(fd, 0, SEEK_END);
+  long size = ftell(fd);
+  fclose(fd);
+  return size;
+}
+
+static capture_trailer read_trailer(long size) {
+  capture_trailer trailer;
+  FILE* fd = fopen(path, "rb");
+  fseek(fd, size - sizeof(trailer), SEEK_SET);
+  CHECK(fread(&trailer, sizeof(trailer), 1, fd) == 1);
+  fclose(fd);
+  return trailer;
+}
+
+static int replay(bool* complete) {
+  submitted = setups = cleanups = 0;
+  int frames = capture_replay(path, &recorder, NULL, false, complete);
+  if (frames >= 0)
+    CHECK(frames == submitted && setups == 1 && cleanups == 1);
+  return frames;
+}
+
+static void overwrite(long offset, const void* data, size_t length) {
+  FILE* fd = fopen(path, "r+b");
+  fseek(fd, offset, SEEK_SET);
+  CHECK(fwrite(data, length, 1, fd) == 1);
+  fclose(fd);
+}
+
+int main(void) {
+  snprintf(path, sizeof(path), "/tmp/moonlight-capture-%d", (int) getpid());
+  bool complete;
+
+  // a closed capture replays up to its index, not into it
+  long size = record();
+  capture_trailer trailer = read_trailer(size);
+  CHECK(trailer.count == FRAMES);
+  CHECK(replay(&complete) == FRAMES && complete);
+
+  // a capture that was never closed has no index
+  CHECK(truncate(path, trailer.index_offset) == 0);
+  CHECK(replay(&complete) == FRAMES && complete);
+
+  // the last record cut short
+  CHECK(truncate(path, trailer.index_offset - 10) == 0);
+  CHECK(replay(&complete) == FRAMES - 1 && !complete);
+
+  // cut right after the record header
+  record();
+  CHECK(truncate(path, sizeof(capture_header) + sizeof(capture_record) + 4) == 0);
+  CHECK(replay(&complete) == 0 && !complete);
+
+  // a buffer length reaching into the index
+  size = record();
+  uint32_t huge = 1 << 20;
+  overwrite(sizeof(capture_header) + sizeof(capture_record) + 4, &huge, sizeof(huge));
+  CHECK(replay(&complete) == 0 && !complete);
+
+  // not a capture at all
+  record();
+  overwrite(0, "garbage!", 8);
+  CHECK(replay(&complete) == -1);
+
+  remove(path);
+  CHECK(capture_replay(path, &recorder, NULL, false, &complete) == -1);
+  return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "video/frame_queue.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define STRESS_FRAMES 1000000
+
+// what the decoder "decoded" into each slot; check is written last and has
+// to match, a torn frame means both sides had the same slot
+static struct {
+  volatile uint32_t number;
+  volatile uint32_t check;
+} slots[FRAME_QUEUE_SIZE];
+
+static frame_queue queue;
+static volatile bool done;
+
+static void check_distinct(frame_queue* q) {
+  int ready = __atomic_load_n(&q->ready, __ATOMIC_ACQUIRE) & 0xff;
+  CHECK(q->write != q->present && q->write != ready && q->present != ready);
+}
+
+static void test_policy(void) {
+  frame_queue_init(&queue);
+  check_distinct(&queue);
+
+  // nothing published yet
+  CHECK(!frame_queue_acquire(&queue));
+
+  int first = frame_queue_write_slot(&queue);
+  CHECK(!frame_queue_publish(&queue));
+  check_distinct(&queue);
+  CHECK(frame_queue_acquire(&queue));
+  CHECK(frame_queue_present_slot(&queue) == first);
+  // the same frame isn't handed out twice
+  CHECK(!frame_queue_acquire(&queue));
+  CHECK(frame_queue_present_slot(&queue) == first);
+
+  // a frame that was never presented is replaced by the newer one
+  CHECK(!frame_queue_publish(&queue));
+  int newest = frame_queue_write_slot(&queue);
+  CHECK(frame_queue_publish(&queue));
+  check_distinct(&queue);
+  CHECK(frame_queue_acquire(&queue));
+  CHECK(frame_queue_present_slot(&queue) == newest);
+  CHECK(!frame_queue_acquire(&queue));
+
+  // the decoder never gets the slot that is being presented
+  for (int i = 0; i < 10; i++) {
+    CHECK(frame_queue_write_slot(&queue) != frame_queue_present_slot(&queue));
+    frame_queue_publish(&queue);
+    if (i % 3 == 0)
+      frame_queue_acquire(&queue);
+    check_distinct(&queue);
+  }
+}
+
+static void* producer(void* arg) {
+  for (uint32_t n = 1; n <= STRESS_FRAMES; n++) {
+    int slot = frame_queue_write_slot(&queue);
+    slots[slot].number = n;
+    slots[slot].check = ~n;
+    frame_queue_publish(&queue);
+    // "decode" the next one
+    for (volatile int spin = 0; spin < 50; spin++);
+  }
+  __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void test_stress(void) {
+  frame_queue_init(&queue);
+  for (int i = 0; i < FRAME_QUEUE_SIZE; i++) {
+    slots[i].number = 0;
+    slots[i].check = ~0u;
+  }
+
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, producer, NULL) == 0);
+
+  uint32_t last = 0, presented = 0;
+  for (;;) {
+    bool finished = __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+    if (frame_queue_acquire(&queue)) {
+      int slot = frame_queue_present_slot(&queue);
+      uint32_t number = slots[slot].number;
+      // "present" for a moment, the producer must not touch the slot
+      for (volatile int spin = 0; spin < 50; spin++);
+      CHECK(slots[slot].number == number);
+      CHECK(slots[slot].check == ~number);
+      // frames only ever get newer
+      CHECK(number > last);
+      last = number;
+      presented++;
+    } else if (finished) {
+      break;
+    }
+  }
+  pthread_join(thread, NULL);
+
+  // the newest frame is never lost
+  CHECK(last == STRESS_FRAMES);
+  printf("frame_queue: %u of %u frames presented\n", presented, STRESS_FRAMES);
+}
+
+int main(void) {
+  test_policy();
+  test_stress();
+  return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "audio/jitter.h"
+
+#include <string.h>
+
+// what the Vita renderer runs with: 5 ms packets, 20 ms output blocks
+#define RATE 48000
+#define PACKET 240
+#define BLOCK 960
+#define CAPACITY 9600
+#define MIN_TARGET 240
+#define MAX_TARGET 4800
+#define SECONDS 120
+// averages are taken over the end of a run, long enough for a packet's
+// worth of drift at 200 ppm to come and go twice
+#define SETTLED 50
+
+typedef enum {
+  STEADY,
+  // every packet late by up to 8 ms, still in order
+  JITTERED,
+  // the network stalls for 60 ms four times a second and then delivers at
+  // once
+  BURSTY,
+  // 5% of the packets never arrive, one at a time, and are concealed
+  LOSSY,
+  // a single 400 ms stall
+  STALL,
+} trace;
+
+typedef struct {
+  uint32_t underruns;
+  uint32_t overruns;
+  uint32_t target;
+  // over the last SETTLED seconds, right after a block was read
+  double depth;
+  double ratio;
+} result;
+
+static short pcm[PACKET * 2 * 2];
+static short out[BLOCK * 2];
+
+// packet n as it was sent, host time in us, drift_ppm faster than the port
+static uint64_t sent(int n, int drift_ppm) {
+  return 1000000 + (uint64_t) n * 5000 - (int64_t) n * 5000 * drift_ppm / 1000000;
+}
+
+static result run(trace kind, int drift_ppm) {
+  jitter_buffer jitter;
+  CHECK(jitter_init(&jitter, RATE, CAPACITY, MIN_TARGET, MAX_TARGET) == 0);
+
+  uint32_t state = 0x9e3779b9;
+  uint64_t last_arrival = 0;
+  uint64_t read_time = sent(0, 0) + 20000;
+  int packets = SECONDS * 200;
+  bool pending_loss = false;
+  double depth_total = 0, ratio_total = 0;
+  int samples = 0;
+
+  for (int n = 0; n < packets; n++) {
+    uint64_t arrival = sent(n, drift_ppm);
+    switch (kind) {
+    case JITTERED:
+      arrival += test_random(&state) % 8000;
+      break;
+    case BURSTY:
+      // everything sent during the stall comes in at its end
+      if ((arrival - 1000000) % 250000 < 60000)
+        arrival += 60000 - (arrival - 1000000) % 250000;
+      break;
+    case STALL:
+      if (n >= 6000 && n < 6080)
+        arrival = sent(6080, drift_ppm);
+      break;
+    default:
+      break;
+    }
+    if (arrival < last_arrival)
+      arrival = last_arrival;
+    last_arrival = arrival;
+
+    // the output blocks that were due before this packet
+    for (; read_time <= arrival; read_time += BLOCK * 1000000 / RATE) {
+      jitter_read(&jitter, out, BLOCK);
+      if (read_time > sent(packets, 0) - SETTLED * 1000000) {
+        depth_total += jitter_depth(&jitter);
+        ratio_total += jitter.ratio;
+        samples++;
+      }
+    }
+
+    if (kind == LOSSY && n > 0 && !pending_loss && test_random(&state) % 20 == 0) {
+      pending_loss = true;
+      continue;
+    }
+    // a lost packet is made up for once the next one is there
+    if (pending_loss) {
+      jitter_lost(&jitter, PACKET);
+      jitter_write(&jitter, pcm, PACKET);
+      pending_loss = false;
+    }
+    jitter_arrival(&jitter, PACKET, arrival);
+    jitter_write(&jitter, pcm, PACKET);
+  }
+
+  result r = {
+    .underruns = jitter.underruns,
+    .overruns = jitter.overruns,
+    .target = jitter.target,
+    .depth = samples ? depth_total / samples : 0,
+    .ratio = samples ? ratio_total / samples : 0,
+  };
+  printf("jitter %d (%+d ppm): %u underruns, %u overruns, target %u, depth %.0f, ratio %.0f ppm\n",
+         kind, drift_ppm, r.underruns, r.overruns, r.target, r.depth, r.ratio);
+  jitter_destroy(&jitter);
+  return r;
+}
+
+// the buffer holds the target after a read and resamples by the drift
+static void check_settled(result r, int drift_ppm) {
+  CHECK(r.depth > r.target - PACKET / 2 && r.depth < r.target + PACKET / 2);
+  CHECK(r.ratio > drift_ppm - 50 && r.ratio < drift_ppm + 50);
+}
+
+int main(void) {
+  memset(pcm, 0, sizeof(pcm));
+
+  // a clean network needs no more than the minimum, whichever clock is faster
+  for (int drift = -200; drift <= 200; drift += 200) {
+    result r = run(STEADY, drift);
+    CHECK(r.underruns == 0 && r.overruns == 0);
+    CHECK(r.target == MIN_TARGET);
+    check_settled(r, drift);
+  }
+
+  // the target covers the jitter, about 8 ms
+  result r = run(JITTERED, 0);
+  CHECK(r.underruns == 0 && r.overruns == 0);
+  CHECK(r.target > 6 * RATE / 1000 && r.target < 9 * RATE / 1000);
+  check_settled(r, 0);
+
+  // only the first stall runs the buffer dry, the target covers the rest
+  r = run(BURSTY, 0);
+  CHECK(r.underruns == 1 && r.overruns <= 1);
+  CHECK(r.target > 50 * RATE / 1000 && r.target <= MAX_TARGET);
+  check_settled(r, 0);
+
+  // a concealed packet comes with the next one, which the target covers
+  r = run(LOSSY, 0);
+  CHECK(r.underruns == 0 && r.overruns == 0);
+  CHECK(r.target == MIN_TARGET);
+  check_settled(r, 0);
+
+  // a stall longer than the buffer: one underrun, the burst after it doesn't
+  // fit, and then it goes back to normal
+  r = run(STALL, 0);
+  CHECK(r.underruns == 1 && r.overruns > 0);
+  check_settled(r, 0);
+  return 0;
+}
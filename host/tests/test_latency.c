@@ -0,0 +1,134 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "video/latency.h"
+
+#include <stdbool.h>
+
+static latency_ring ring;
+
+// a frame going through every stage, each one step later than the last
+static void run_frame(uint32_t frame, uint64_t received, uint32_t step) {
+  latency_begin(&ring, frame, received);
+  for (int stage = LATENCY_SUBMITTED; stage < LATENCY_STAGES; stage++)
+    latency_mark(&ring, frame, stage, received + (uint64_t) step * stage);
+}
+
+static void test_wraparound(void) {
+  latency_ring_init(&ring);
+
+  for (uint32_t frame = 1; frame <= 3 * LATENCY_RING_SIZE + 10; frame++)
+    run_frame(frame, frame * 1000, 10);
+
+  // the last LATENCY_RING_SIZE frames are there
+  uint32_t newest = 3 * LATENCY_RING_SIZE + 10;
+  for (uint32_t frame = newest - LATENCY_RING_SIZE + 1; frame <= newest; frame++) {
+    CHECK(latency_stamp(&ring, frame, LATENCY_RECEIVED) == frame * 1000);
+    CHECK(latency_stamp(&ring, frame, LATENCY_SWAPPED) == frame * 1000 + 10 * LATENCY_SWAPPED);
+  }
+
+  // older ones had their slot taken by a newer frame
+  uint32_t old = newest - LATENCY_RING_SIZE;
+  CHECK(latency_stamp(&ring, old, LATENCY_RECEIVED) == 0);
+  CHECK(latency_stamp(&ring, 1, LATENCY_DECODED) == 0);
+
+  // a late stamp for one of them is dropped, it doesn't land on the frame
+  // now using the slot
+  latency_mark(&ring, old, LATENCY_DECODED, 1);
+  CHECK(latency_stamp(&ring, newest, LATENCY_DECODED) == newest * 1000 + 10 * LATENCY_DECODED);
+
+  // a stage not stamped yet reads 0
+  latency_begin(&ring, newest + 1, 5000000);
+  CHECK(latency_stamp(&ring, newest + 1, LATENCY_RECEIVED) == 5000000);
+  CHECK(latency_stamp(&ring, newest + 1, LATENCY_SUBMITTED) == 0);
+
+  // frame numbers near the top of the range use the slots all the same
+  for (uint32_t frame = UINT32_MAX - 300; frame != 0; frame++)
+    run_frame(frame, 7000, 1);
+  CHECK(latency_stamp(&ring, UINT32_MAX, LATENCY_DRAWN) == 7000 + LATENCY_DRAWN);
+  CHECK(latency_stamp(&ring, UINT32_MAX - LATENCY_RING_SIZE, LATENCY_RECEIVED) == 0);
+}
+
+static void test_percentiles(void) {
+  latency_percentiles stats[LATENCY_STAGES];
+  latency_ring_init(&ring);
+
+  latency_summary(&ring, stats);
+  for (int stage = 0; stage < LATENCY_STAGES; stage++)
+    CHECK(stats[stage].samples == 0 && stats[stage].p50 == 0 && stats[stage].p99 == 0);
+
+  // 100 frames: 90 decode in 5 ms, 10 take 50 ms, in no particular order
+  int slow = 0;
+  for (uint32_t frame = 1; frame <= 100; frame++) {
+    bool late = frame * 37 % 100 < 10;
+    slow += late;
+    uint64_t received = frame * 16683;
+    latency_begin(&ring, frame, received);
+    latency_mark(&ring, frame, LATENCY_SUBMITTED, received + 1000);
+    latency_mark(&ring, frame, LATENCY_DECODED, received + 1000 + (late ? 50000 : 5000));
+  }
+  CHECK(slow == 10);
+
+  latency_summary(&ring, stats);
+  CHECK(stats[LATENCY_SUBMITTED].samples == 100 && stats[LATENCY_SUBMITTED].p99 == 1000);
+  CHECK(stats[LATENCY_DECODED].samples == 100);
+  CHECK(stats[LATENCY_DECODED].p50 == 5000);
+  CHECK(stats[LATENCY_DECODED].p95 == 50000);
+  CHECK(stats[LATENCY_DECODED].p99 == 50000);
+  // none were drawn, there is no whole way yet
+  CHECK(stats[LATENCY_DRAWN].samples == 0);
+  CHECK(stats[LATENCY_RECEIVED].samples == 0);
+
+  // a full ring of swap times 1000 to 1255 us, shuffled
+  uint32_t state = 1;
+  uint32_t order[LATENCY_RING_SIZE];
+  for (uint32_t i = 0; i < LATENCY_RING_SIZE; i++)
+    order[i] = i;
+  for (uint32_t i = LATENCY_RING_SIZE - 1; i > 0; i--) {
+    uint32_t j = test_random(&state) % (i + 1);
+    uint32_t t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for (uint32_t i = 0; i < LATENCY_RING_SIZE; i++) {
+    uint32_t frame = 1000 + i;
+    uint64_t received = frame * 16683;
+    latency_begin(&ring, frame, received);
+    for (int stage = LATENCY_SUBMITTED; stage < LATENCY_SWAPPED; stage++)
+      latency_mark(&ring, frame, stage, received + stage);
+    latency_mark(&ring, frame, LATENCY_SWAPPED, received + 1000 + order[i]);
+  }
+
+  latency_summary(&ring, stats);
+  CHECK(stats[LATENCY_RECEIVED].samples == LATENCY_RING_SIZE);
+  CHECK(stats[LATENCY_RECEIVED].p50 == 1000 + 127);
+  CHECK(stats[LATENCY_RECEIVED].p95 == 1000 + 242);
+  CHECK(stats[LATENCY_RECEIVED].p99 == 1000 + 252);
+  CHECK(stats[LATENCY_DECODED].p50 == 1 && stats[LATENCY_DECODED].p99 == 1);
+  CHECK(stats[LATENCY_SWAPPED].p50 == 1000 + 127 - LATENCY_DRAWN);
+}
+
+int main(void) {
+  test_wraparound();
+  test_percentiles();
+  return 0;
+}
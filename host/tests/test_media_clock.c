@@ -0,0 +1,184 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "media_clock.h"
+
+#include <stdbool.h>
+
+#define RATE 48000
+#define PACKET 240
+#define BLOCK 960
+// what the port is handed ahead of playing it, as the audio thread does
+#define BUFFERED 1920
+// the smoothed delays settle within a step of 1/16 of their target
+#define SMOOTHING 16
+
+// Audio produced by the host at host_ppm and played by the port at
+// output_ppm, both against local time
+typedef struct {
+  media_clock clock;
+  int32_t host_ppm;
+  int32_t output_ppm;
+
+  double next_packet;
+  double output_start;
+  uint64_t handed;
+} session;
+
+static void session_init(session* s, int32_t host_ppm, int32_t output_ppm, uint64_t start) {
+  media_clock_init(&s->clock, RATE);
+  s->host_ppm = host_ppm;
+  s->output_ppm = output_ppm;
+  s->next_packet = start;
+  s->output_start = start;
+  s->handed = 0;
+}
+
+// run for the given time in steps of 1 ms, the port stays fed
+static void session_run(session* s, uint64_t from, uint64_t to, bool host_running) {
+  double packet_interval = PACKET * 1e6 / RATE / (1 + s->host_ppm / 1e6);
+  double output_rate = RATE * (1 + s->output_ppm / 1e6) / 1e6;
+  for (uint64_t now = from; now < to; now += 1000) {
+    if (host_running) {
+      while (s->next_packet <= now) {
+        media_clock_audio_arrival(&s->clock, PACKET, (uint64_t) s->next_packet);
+        s->next_packet += packet_interval;
+      }
+    } else {
+      s->next_packet = now;
+    }
+
+    uint64_t played = (uint64_t) ((now - s->output_start) * output_rate);
+    uint32_t rest = s->handed > played ? s->handed - played : 0;
+    if (rest <= BLOCK) {
+      media_clock_audio_output(&s->clock, BLOCK, BUFFERED, rest, now);
+      s->handed += BLOCK;
+    }
+  }
+}
+
+static void test_drift(int32_t host_ppm, int32_t output_ppm) {
+  session s;
+  uint64_t start = 1000000;
+  session_init(&s, host_ppm, output_ppm, start);
+
+  // nothing reported before both sides were measured long enough
+  session_run(&s, start, start + MEDIA_CLOCK_SETTLE - 100000, true);
+  CHECK(media_clock_drift(&s.clock) == 0);
+
+  session_run(&s, start + MEDIA_CLOCK_SETTLE - 100000, start + 60000000, true);
+  CHECK(abs(s.clock.host_drift - host_ppm) <= 2);
+  CHECK(abs(s.clock.output_drift - output_ppm) <= 2);
+  int32_t drift = media_clock_drift(&s.clock);
+  CHECK(abs(drift - (host_ppm - output_ppm)) <= 4);
+}
+
+static void test_pause(void) {
+  session s;
+  uint64_t start = 1000000;
+  session_init(&s, 300, 0, start);
+
+  uint64_t now = start + 15000000;
+  session_run(&s, start, now, true);
+  CHECK(abs(s.clock.host_drift - 300) <= 2);
+
+  // a gap between packets longer than MEDIA_CLOCK_PAUSE is the stream
+  // pausing, not the host slowing down: the window starts anew and the
+  // last rate stays until the new one is measured
+  session_run(&s, now, now + 2000000, false);
+  now += 2000000;
+  session_run(&s, now, now + MEDIA_CLOCK_SETTLE / 2, true);
+  now += MEDIA_CLOCK_SETTLE / 2;
+  CHECK(abs(s.clock.host_drift - 300) <= 2);
+  CHECK(now - s.clock.host_start < MEDIA_CLOCK_SETTLE);
+
+  session_run(&s, now, now + 20000000, true);
+  CHECK(abs(s.clock.host_drift - 300) <= 2);
+
+  // a shorter gap is only jitter and stays in the window
+  uint64_t host_start = s.clock.host_start;
+  now += 20000000;
+  session_run(&s, now, now + 400000, false);
+  now += 400000;
+  session_run(&s, now, now + 1000000, true);
+  CHECK(s.clock.host_start == host_start);
+
+  // the port running dry restarts the output window the same way
+  media_clock_audio_idle(&s.clock);
+  CHECK(s.clock.output_start == 0);
+}
+
+static void test_output_count(void) {
+  media_clock clock;
+  media_clock_init(&clock, RATE);
+  media_clock_audio_output(&clock, BLOCK, 0, 0, 1000000);
+
+  // the port claiming to hold more than it was ever given doesn't make the
+  // count wrap around to a huge rate
+  media_clock_audio_output(&clock, BLOCK, 0, 3 * BLOCK, 1000000 + MEDIA_CLOCK_SETTLE + 1);
+  CHECK(clock.output_drift == INT32_MIN);
+}
+
+static void test_av_offset(void) {
+  media_clock clock;
+  media_clock_init(&clock, RATE);
+
+  // 100 ms of audio in front of the port
+  uint64_t now = 1000000;
+  media_clock_audio_output(&clock, BLOCK, 4800, 0, now);
+  CHECK(clock.audio_delay == 100000);
+  // no video yet
+  CHECK(media_clock_av_offset(&clock) == 0);
+
+  // the picture comes out 130 ms after it arrived, 30 ms after the sound
+  for (int i = 0; i < 200; i++) {
+    now += 16683;
+    media_clock_video_presented(&clock, now - 130000, now);
+    media_clock_audio_output(&clock, BLOCK, 4800, 0, now);
+  }
+  CHECK(abs(media_clock_av_offset(&clock) - 30000) < SMOOTHING);
+
+  // then 60 ms, 40 ms before the sound; the delays follow smoothly
+  media_clock_video_presented(&clock, now - 60000, now);
+  int32_t offset = media_clock_av_offset(&clock);
+  CHECK(offset < 30000 && offset > 0);
+  for (int i = 0; i < 200; i++) {
+    now += 16683;
+    media_clock_video_presented(&clock, now - 60000, now);
+  }
+  CHECK(abs(media_clock_av_offset(&clock) + 40000) < SMOOTHING);
+
+  // a frame without a receive time doesn't count
+  media_clock_video_presented(&clock, 0, now);
+  CHECK(abs(media_clock_av_offset(&clock) + 40000) < SMOOTHING);
+}
+
+int main(void) {
+  test_drift(300, 0);
+  test_drift(0, 300);
+  test_drift(-150, 250);
+  test_drift(500, 480);
+  test_pause();
+  test_output_count();
+  test_av_offset();
+  return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "media_queue.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_AGE 100000
+
+static uint64_t clock_now;
+static int released[64];
+static int release_count;
+
+static uint64_t fake_clock(void) {
+  return clock_now;
+}
+
+static void release(media_item* item) {
+  released[release_count++] = item->number;
+}
+
+static void push(media_queue* queue, int number, int flags) {
+  media_item item = { .number = number, .flags = flags, .arrival = clock_now };
+  media_queue_push(queue, &item);
+}
+
+static int pop(media_queue* queue, uint32_t* dropped) {
+  media_item item;
+  if (!media_queue_pop(queue, &item, NULL, 0))
+    return 0;
+  if (dropped != NULL)
+    *dropped = item.dropped;
+  return item.number;
+}
+
+static void init(media_queue* queue, int capacity) {
+  clock_now = 1000000;
+  release_count = 0;
+  CHECK(media_queue_init(queue, "test", capacity, 0, MAX_AGE, release, fake_clock) == 0);
+}
+
+static void test_full(void) {
+  media_queue queue;
+  uint32_t dropped;
+  init(&queue, 4);
+
+  // the oldest disposable item makes room, not the oldest one
+  push(&queue, 1, 0);
+  push(&queue, 2, MEDIA_ITEM_DISPOSABLE);
+  push(&queue, 3, 0);
+  push(&queue, 4, MEDIA_ITEM_DISPOSABLE);
+  push(&queue, 5, 0);
+  CHECK(queue.dropped_full == 1 && queue.dropped_disposable == 1 && queue.dropped_required == 0);
+  CHECK(release_count == 1 && released[0] == 2);
+
+  // without disposable ones the oldest goes
+  push(&queue, 6, 0);
+  push(&queue, 7, 0);
+  CHECK(queue.dropped_full == 3 && queue.dropped_disposable == 2 && queue.dropped_required == 1);
+  CHECK(release_count == 3 && released[1] == 4 && released[2] == 1);
+
+  // each item tells how many went right before it
+  CHECK(pop(&queue, &dropped) == 3 && dropped == 2);
+  CHECK(pop(&queue, &dropped) == 5 && dropped == 1);
+  CHECK(pop(&queue, &dropped) == 6 && dropped == 0);
+  CHECK(pop(&queue, &dropped) == 7 && dropped == 0);
+  CHECK(pop(&queue, NULL) == 0);
+  CHECK(queue.pushed == 7 && queue.max_depth == 4);
+
+  // make_room drops ahead of a push the same way
+  for (int i = 10; i < 14; i++)
+    push(&queue, i, 0);
+  media_queue_make_room(&queue);
+  CHECK(media_queue_depth(&queue) == 3 && queue.dropped_required == 2);
+  CHECK(pop(&queue, &dropped) == 11 && dropped == 1);
+
+  media_queue_destroy(&queue);
+  // destroy hands back what was still queued
+  CHECK(release_count == 6 && released[4] == 12 && released[5] == 13);
+}
+
+static void test_age(void) {
+  media_queue queue;
+  uint32_t dropped;
+  init(&queue, 8);
+
+  push(&queue, 1, 0);
+  push(&queue, 2, MEDIA_ITEM_DISPOSABLE);
+  clock_now += 40000;
+  push(&queue, 3, MEDIA_ITEM_DISPOSABLE);
+  push(&queue, 4, 0);
+  clock_now += 40000;
+  push(&queue, 5, 0);
+
+  // nothing is old enough yet
+  clock_now += MAX_AGE - 80000;
+  CHECK(pop(&queue, &dropped) == 1 && dropped == 0);
+
+  // only the items past max_age go, the newer ones are still good
+  clock_now += 50000;
+  CHECK(pop(&queue, &dropped) == 5 && dropped == 3);
+  CHECK(queue.dropped_age == 3 && queue.dropped_disposable == 2 && queue.dropped_required == 1);
+  CHECK(release_count == 3 && released[0] == 2 && released[1] == 3 && released[2] == 4);
+
+  // a queue of nothing but expired items is emptied
+  push(&queue, 6, 0);
+  push(&queue, 7, MEDIA_ITEM_DISPOSABLE);
+  clock_now += MAX_AGE + 1;
+  CHECK(pop(&queue, &dropped) == 0);
+  CHECK(media_queue_depth(&queue) == 0 && queue.dropped_age == 5 && queue.dropped_required == 2);
+  // the drops are still told with the next item, on top of what the
+  // producer threw away itself
+  media_item item = { .number = 8, .arrival = clock_now, .dropped = 1 };
+  media_queue_push(&queue, &item);
+  CHECK(pop(&queue, &dropped) == 8 && dropped == 3);
+
+  media_queue_destroy(&queue);
+}
+
+static void test_payload(void) {
+  media_queue queue;
+  clock_now = 1000000;
+  CHECK(media_queue_init(&queue, "test", 2, 8, MAX_AGE, NULL, fake_clock) == 0);
+
+  // the queue keeps a copy, cut to payload_size
+  char data[16] = "0123456789abcdef";
+  media_item item = { .data = data, .length = 16, .number = 1, .arrival = clock_now };
+  media_queue_push(&queue, &item);
+  item.length = 3;
+  item.number = 2;
+  media_queue_push(&queue, &item);
+  memset(data, 'x', sizeof(data));
+  // a full queue gives up a slot for the new copy
+  item.number = 3;
+  media_queue_push(&queue, &item);
+
+  char buffer[8];
+  CHECK(media_queue_pop(&queue, &item, buffer, 0));
+  CHECK(item.number == 2 && item.dropped == 1 && item.length == 3);
+  CHECK(item.data == buffer && memcmp(buffer, "012", 3) == 0);
+  CHECK(media_queue_pop(&queue, &item, buffer, 0));
+  CHECK(item.number == 3 && item.length == 3 && memcmp(buffer, "xxx", 3) == 0);
+  CHECK(queue.free_count == 2);
+
+  media_queue_destroy(&queue);
+}
+
+static void* late_push(void* arg) {
+  usleep(20000);
+  push(arg, 1, 0);
+  return NULL;
+}
+
+static void test_wakeup(void) {
+  media_queue queue;
+  init(&queue, 4);
+
+  // popping items that were already there takes their signals too, so an
+  // empty queue waits the whole timeout instead of waking up for nothing
+  for (int i = 1; i <= 3; i++)
+    push(&queue, i, 0);
+  push(&queue, 4, MEDIA_ITEM_DISPOSABLE);
+  push(&queue, 5, 0);
+  for (int i = 0; i < 4; i++)
+    CHECK(pop(&queue, NULL) != 0);
+  media_item item;
+  uint64_t start = test_now_ns();
+  CHECK(!media_queue_pop(&queue, &item, NULL, 30000));
+  CHECK(test_now_ns() - start >= 25000000);
+
+  // a push wakes a waiting consumer
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, late_push, &queue) == 0);
+  start = test_now_ns();
+  CHECK(media_queue_pop(&queue, &item, NULL, 1000000) && item.number == 1);
+  CHECK(test_now_ns() - start < 500000000);
+  pthread_join(thread, NULL);
+
+  media_queue_destroy(&queue);
+}
+
+int main(void) {
+  test_full();
+  test_age();
+  test_payload();
+  test_wakeup();
+  return 0;
+}
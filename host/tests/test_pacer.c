@@ -0,0 +1,146 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "video/pacer.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+// Replays a frame timeline against a simulated 59.94 Hz display: vblanks
+// every PERIOD us, frames finishing decode around the host's 60 fps with
+// the given jitter. Times are in us.
+
+#define PERIOD 16683
+#define FRAME_INTERVAL 16667
+#define MARGIN 3000
+#define TARGET_LATENCY 34000
+#define SECONDS 60
+
+typedef struct {
+  uint32_t frames;
+  uint32_t presented;
+  uint32_t held;
+  uint32_t dropped;
+  uint32_t max_drops_in_row;
+  uint32_t average_latency;
+} replay_result;
+
+// jitter is the largest random decode delay, burst_every makes every nth
+// frame arrive right after the one before it
+static replay_result replay(uint32_t jitter, uint32_t burst_every) {
+  frame_pacer pacer;
+  pacer_init(&pacer, TARGET_LATENCY, PERIOD, MARGIN);
+
+  replay_result result;
+  memset(&result, 0, sizeof(result));
+  uint32_t seed = 7;
+  uint32_t vcount = 0;
+  uint64_t vblank_time = PERIOD;
+  uint64_t frame_time = FRAME_INTERVAL;
+  uint64_t previous_ready = 0;
+  uint32_t drops_in_row = 0;
+  // vblank the last frame that wasn't dropped waits for
+  uint32_t last_target = 0;
+  bool queued = false;
+
+  while (vblank_time < (uint64_t) SECONDS * 1000000) {
+    uint64_t ready = frame_time + (jitter ? test_random(&seed) % jitter : 0);
+    if (burst_every && result.frames % burst_every == burst_every - 1)
+      ready = previous_ready + 100;
+    if (ready < previous_ready)
+      ready = previous_ready;
+
+    if (vblank_time <= ready) {
+      pacer_vblank(&pacer, ++vcount, vblank_time);
+      vblank_time += PERIOD;
+      continue;
+    }
+
+    uint64_t present_at;
+    pacer_action action = pacer_decide(&pacer, ready, ready, &present_at);
+    result.frames++;
+    previous_ready = ready;
+    frame_time += FRAME_INTERVAL;
+
+    if (action == PACER_DROP) {
+      result.dropped++;
+      if (++drops_in_row > result.max_drops_in_row)
+        result.max_drops_in_row = drops_in_row;
+      continue;
+    }
+    drops_in_row = 0;
+    if (vcount == 0) {
+      // nothing to align to before the first vblank
+      CHECK(action == PACER_PRESENT);
+      result.presented++;
+      continue;
+    }
+
+    // never two frames for the same vblank, and never one the frame can't make
+    CHECK(!queued || (int32_t) (pacer.last_target - last_target) > 0);
+    CHECK(pacer.last_target > vcount);
+    last_target = pacer.last_target;
+    queued = true;
+
+    if (action == PACER_HOLD) {
+      result.held++;
+      // drawn after the vblank before the one it waits for
+      uint64_t target_time = vblank_time + (uint64_t) (last_target - vcount - 1) * PERIOD;
+      CHECK(present_at > target_time - PERIOD && present_at < target_time);
+    } else {
+      result.presented++;
+      CHECK(present_at == ready);
+    }
+  }
+
+  result.average_latency = pacer_average_latency(&pacer);
+  CHECK(result.presented == pacer.presented && result.held == pacer.held && result.dropped == pacer.dropped);
+  return result;
+}
+
+static void print(const char* name, replay_result* r) {
+  printf("%-8s %u frames: %u presented, %u held, %u dropped (max %u in a row), latency avg %u us\n",
+         name, r->frames, r->presented, r->held, r->dropped, r->max_drops_in_row, r->average_latency);
+}
+
+int main(void) {
+  // frames right on time: the 60 vs 59.94 Hz beat costs a frame now and then
+  replay_result steady = replay(0, 0);
+  print("steady", &steady);
+  CHECK(steady.dropped <= SECONDS / 16 + 1);
+  CHECK(steady.average_latency <= TARGET_LATENCY);
+
+  // decode jitter of up to half a frame
+  replay_result jitter = replay(FRAME_INTERVAL / 2, 0);
+  print("jitter", &jitter);
+  CHECK(jitter.max_drops_in_row <= 2);
+  CHECK(jitter.dropped < jitter.frames / 20);
+  CHECK(jitter.average_latency <= TARGET_LATENCY);
+
+  // every tenth frame arrives together with the one before
+  replay_result burst = replay(FRAME_INTERVAL / 4, 10);
+  print("burst", &burst);
+  CHECK(burst.max_drops_in_row <= 2);
+  CHECK(burst.held + burst.dropped >= burst.frames / 10 - 1);
+  CHECK(burst.average_latency <= TARGET_LATENCY);
+  return 0;
+}
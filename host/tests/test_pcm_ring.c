@@ -0,0 +1,136 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "audio/pcm_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define STRESS_FRAMES 4000000
+#define STRESS_CHUNK 300
+
+// frame n carries n in the left channel and ~n in the right one, so a torn
+// or reordered frame shows up on the consumer side
+static pcm_ring ring;
+
+static void fill(short* pcm, uint32_t first, uint32_t frames) {
+  for (uint32_t i = 0; i < frames; i++) {
+    pcm[i * 2] = (short) (first + i);
+    pcm[i * 2 + 1] = (short) ~(first + i);
+  }
+}
+
+static void test_basics(void) {
+  short pcm[16 * 2];
+
+  CHECK(pcm_ring_init(&ring, 5) == 0);
+  CHECK(ring.capacity == 8);
+  CHECK(pcm_ring_count(&ring) == 0);
+
+  // a write into a full ring is cut short
+  fill(pcm, 0, 16);
+  CHECK(pcm_ring_write(&ring, pcm, 6) == 6);
+  CHECK(pcm_ring_write(&ring, pcm + 6 * 2, 10) == 2);
+  CHECK(pcm_ring_write(&ring, pcm, 1) == 0);
+  CHECK(pcm_ring_count(&ring) == 8);
+  for (uint32_t i = 0; i < 8; i++)
+    CHECK(pcm_ring_sample(&ring, i, 0) == (short) i);
+
+  // wrap around the end of the buffer
+  pcm_ring_advance(&ring, 5);
+  CHECK(pcm_ring_count(&ring) == 3);
+  fill(pcm, 8, 5);
+  CHECK(pcm_ring_write(&ring, pcm, 5) == 5);
+  CHECK(pcm_ring_count(&ring) == 8);
+  for (uint32_t i = 0; i < 8; i++) {
+    CHECK(pcm_ring_sample(&ring, i, 0) == (short) (5 + i));
+    CHECK(pcm_ring_sample(&ring, i, 1) == (short) ~(5 + i));
+  }
+
+  pcm_ring_destroy(&ring);
+}
+
+static void* producer(void* arg) {
+  short pcm[STRESS_CHUNK * 2];
+  uint32_t state = 0x1234567;
+  uint32_t next = 0;
+  while (next < STRESS_FRAMES) {
+    uint32_t frames = test_random(&state) % STRESS_CHUNK + 1;
+    if (frames > STRESS_FRAMES - next)
+      frames = STRESS_FRAMES - next;
+    fill(pcm, next, frames);
+    // the decoder retries whatever didn't fit
+    uint32_t written = 0;
+    while (written < frames) {
+      uint32_t n = pcm_ring_write(&ring, pcm + written * 2, frames - written);
+      if (n == 0)
+        sched_yield();
+      written += n;
+    }
+    next += frames;
+  }
+  return NULL;
+}
+
+static void test_stress(void) {
+  CHECK(pcm_ring_init(&ring, 1024) == 0);
+
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, producer, NULL) == 0);
+
+  uint32_t state = 0x7654321;
+  uint32_t next = 0, empty = 0;
+  uint64_t start = test_now_ns();
+  while (next < STRESS_FRAMES) {
+    uint32_t count = pcm_ring_count(&ring);
+    CHECK(count <= ring.capacity);
+    if (count == 0) {
+      empty++;
+      sched_yield();
+      continue;
+    }
+
+    // the output callback takes whatever it needs, up to what's there
+    uint32_t frames = test_random(&state) % STRESS_CHUNK + 1;
+    if (frames > count)
+      frames = count;
+    for (uint32_t i = 0; i < frames; i++) {
+      CHECK(pcm_ring_sample(&ring, i, 0) == (short) (next + i));
+      CHECK(pcm_ring_sample(&ring, i, 1) == (short) ~(next + i));
+    }
+    pcm_ring_advance(&ring, frames);
+    next += frames;
+  }
+  uint64_t elapsed = test_now_ns() - start;
+  pthread_join(thread, NULL);
+
+  CHECK(pcm_ring_count(&ring) == 0);
+  printf("pcm_ring: %u frames in %.1f ms, ring empty %u times\n",
+         STRESS_FRAMES, elapsed / 1e6, empty);
+  pcm_ring_destroy(&ring);
+}
+
+int main(void) {
+  test_basics();
+  test_stress();
+  return 0;
+}
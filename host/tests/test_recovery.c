@@ -0,0 +1,197 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "media_queue.h"
+#include "video/recovery.h"
+
+#define FRAME 16667
+
+static recovery_state state;
+static uint64_t now;
+
+// frame n arrives and decodes, returns whether it may be shown
+static bool decode(int n, bool idr, bool ok) {
+  now += FRAME;
+  recovery_frame(&state, n, idr, now);
+  if (!ok) {
+    recovery_decode_error(&state, now);
+    return false;
+  }
+  recovery_decode_ok(&state);
+  return recovery_presentable(&state);
+}
+
+static void test_rfi(void) {
+  recovery_init(&state, true);
+  now = 1000000;
+  for (int n = 1; n <= 10; n++)
+    CHECK(decode(n, false, true));
+
+  // frames 11 and 12 lost; frames that decode fine right after the gap may
+  // still refer to them
+  CHECK(!decode(13, false, true));
+  CHECK(state.status == RECOVERY_WAIT_RFI);
+  CHECK(!recovery_need_idr(&state, now));
+  // errors are expected until the host acted on the RFI request
+  CHECK(!decode(14, false, false));
+  CHECK(state.status == RECOVERY_WAIT_RFI);
+  CHECK(!recovery_need_idr(&state, now));
+
+  int n = 15;
+  while (state.status == RECOVERY_WAIT_RFI) {
+    CHECK(n < 30);
+    decode(n++, false, true);
+  }
+  CHECK(state.status == RECOVERY_OK);
+  // 13 and 15 up to the frame that recovered were not shown
+  CHECK(n - 1 == state.rfi_frame && state.hidden_frames == (uint32_t) (n - 15));
+  CHECK(state.idr_requests == 0);
+
+  // an IDR frame recovers right away
+  CHECK(!decode(n + 3, false, true));
+  CHECK(decode(n + 4, true, true));
+  CHECK(state.status == RECOVERY_OK);
+}
+
+static void test_rfi_second_gap(void) {
+  recovery_init(&state, true);
+  now = 1000000;
+  for (int n = 1; n <= 10; n++)
+    decode(n, false, true);
+
+  decode(12, false, true);
+  int first = state.rfi_frame;
+  // more loss while waiting moves the point of recovery
+  decode(14, false, true);
+  CHECK(state.rfi_frame == first + 2);
+  for (int n = 15; n < state.rfi_frame; n++)
+    CHECK(!decode(n, false, true));
+  CHECK(decode(state.rfi_frame, false, true));
+}
+
+static void test_rfi_deadline(void) {
+  recovery_init(&state, true);
+  now = 1000000;
+  for (int n = 1; n <= 10; n++)
+    decode(n, false, true);
+
+  decode(12, false, true);
+  CHECK(state.status == RECOVERY_WAIT_RFI);
+
+  // the host takes too long, only an IDR frame helps now
+  now += 1000000;
+  CHECK(!decode(13, false, true));
+  CHECK(state.status == RECOVERY_WAIT_IDR);
+  CHECK(recovery_need_idr(&state, now));
+  // and clean decodes don't change that
+  for (int n = 14; n < 30; n++)
+    CHECK(!decode(n, false, true));
+  CHECK(state.status == RECOVERY_WAIT_IDR);
+  CHECK(decode(30, true, true));
+}
+
+static void test_idr_backoff(void) {
+  recovery_init(&state, false);
+  now = 1000000;
+  decode(1, true, true);
+
+  // without RFI a gap is left to the depacketizer's own IDR request
+  CHECK(decode(3, false, true));
+  CHECK(state.status == RECOVERY_OK && state.gaps == 1);
+
+  // a decode error asks for an IDR, then backs off
+  CHECK(!decode(4, false, false));
+  CHECK(recovery_need_idr(&state, now));
+  CHECK(!decode(5, false, false));
+  CHECK(!recovery_need_idr(&state, now));
+  CHECK(state.held_requests == 1);
+  now += 200000;
+  CHECK(recovery_need_idr(&state, now));
+  CHECK(state.idr_requests == 2);
+  CHECK(decode(6, true, true));
+}
+
+static uint64_t queue_clock(void) {
+  return now;
+}
+
+// queued decode as vita.c runs it: the receive side throws away some
+// disposable frames before queueing and the queue drops more when it's full,
+// the decode side only sees what is popped
+static void run_queued(int frames, int lose) {
+  media_queue queue;
+  CHECK(media_queue_init(&queue, "test", 3, 0, 1000000, NULL, queue_clock) == 0);
+  uint32_t unqueued = 0;
+  for (int n = 1; n <= frames; n++) {
+    now += FRAME;
+    // lost in the network, the decoder never hears of it
+    if (n == lose)
+      continue;
+    bool disposable = n % 2 == 0;
+    if (disposable && n % 6 == 0) {
+      unqueued++;
+      continue;
+    }
+    media_item item = {
+      .number = n,
+      .flags = (disposable ? MEDIA_ITEM_DISPOSABLE : 0) | (n == 1 ? MEDIA_ITEM_KEY : 0),
+      .arrival = now,
+      .dropped = unqueued,
+    };
+    unqueued = 0;
+    media_queue_push(&queue, &item);
+
+    // the decoder keeps up with every other frame only
+    if (n % 2 == 1 && media_queue_pop(&queue, &item, NULL, 0)) {
+      recovery_frames_skipped(&state, item.dropped);
+      recovery_frame(&state, item.number, item.flags & MEDIA_ITEM_KEY, now);
+      recovery_decode_ok(&state);
+      recovery_presentable(&state);
+    }
+  }
+  CHECK(queue.dropped_disposable > 0 && queue.dropped_required == 0);
+  media_queue_destroy(&queue);
+}
+
+static void test_queued_drops(void) {
+  // frames thrown away on purpose aren't taken for loss
+  recovery_init(&state, true);
+  now = 1000000;
+  run_queued(120, 0);
+  CHECK(state.gaps == 0 && state.hidden_frames == 0);
+  CHECK(state.status == RECOVERY_OK);
+
+  // while a frame lost in the network still is
+  recovery_init(&state, true);
+  run_queued(120, 61);
+  CHECK(state.gaps == 1 && state.hidden_frames > 0);
+  CHECK(state.status == RECOVERY_OK);
+}
+
+int main(void) {
+  test_rfi();
+  test_rfi_second_gap();
+  test_rfi_deadline();
+  test_idr_backoff();
+  test_queued_drops();
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+
+#include "input/sampler.h"
+
+// 59.94 Hz, what sceDisplayGetRefreshRate reports
+#define PERIOD ((uint32_t) (1000000 / 59.94005))
+#define GUARD 1000
+
+int main(void) {
+  input_sampler sampler;
+  input_sampler_init(&sampler, PERIOD);
+
+  // nothing read yet, try again a frame later
+  CHECK(input_sampler_next(&sampler, 0, 0, false, 5000) == 5000 + PERIOD);
+
+  // ten minutes of play: every wakeup is one frame after the last, just
+  // after the next sample, and finds exactly that sample
+  uint64_t sample = 100000;
+  uint64_t now = sample + 300;
+  uint64_t changed = 0;
+  for (int i = 0; i < 60 * 60 * 10; i++) {
+    changed = now;
+    uint64_t next = input_sampler_next(&sampler, 1, sample, true, now);
+    sample += PERIOD;
+    CHECK(next == sample + GUARD);
+    now = next + 50;
+  }
+  CHECK(sampler.wakeups == 60 * 60 * 10 + 1);
+
+  // the controller is put down: still every frame until it was idle for
+  // INPUT_SAMPLER_IDLE since the last change, then every
+  // INPUT_SAMPLER_IDLE_FRAMES frames
+  uint32_t frames = 1;
+  while (now - changed < INPUT_SAMPLER_IDLE + 1000000) {
+    uint64_t next = input_sampler_next(&sampler, frames, sample, false, now);
+    frames = now - changed < INPUT_SAMPLER_IDLE ? 1 : INPUT_SAMPLER_IDLE_FRAMES;
+    sample += (uint64_t) frames * PERIOD;
+    CHECK(next == sample + GUARD);
+    now = next + 50;
+  }
+  CHECK(frames == INPUT_SAMPLER_IDLE_FRAMES);
+  CHECK(sampler.frames == INPUT_SAMPLER_IDLE_FRAMES);
+
+  // the first wakeup to find a press goes straight back to every frame
+  uint64_t next = input_sampler_next(&sampler, INPUT_SAMPLER_IDLE_FRAMES, sample, true, now);
+  sample += PERIOD;
+  CHECK(next == sample + GUARD);
+  now = next + 50;
+  // and it takes another INPUT_SAMPLER_IDLE to back off again
+  for (int i = 0; i < 60; i++) {
+    next = input_sampler_next(&sampler, 1, sample, false, now);
+    sample += PERIOD;
+    CHECK(next == sample + GUARD);
+    now = next + 50;
+  }
+
+  // a late wakeup (the thread didn't get the CPU) still lines up with the
+  // sample grid, on the next sample that isn't due yet
+  next = input_sampler_next(&sampler, 3, sample, true, sample + 2 * PERIOD + GUARD + 10);
+  CHECK(next == sample + 3 * PERIOD + GUARD);
+
+  // no new sample since the last wakeup, the grid is kept
+  next = input_sampler_next(&sampler, 0, 0, false, sample + 3 * PERIOD + GUARD + 10);
+  CHECK(next == sample + 4 * PERIOD + GUARD);
+
+  // sample to send latency
+  input_sampler_sent(&sampler, 1000, 3000);
+  input_sampler_sent(&sampler, 2000, 6000);
+  input_sampler_sent(&sampler, 0, 6000);
+  CHECK(sampler.events == 2 && input_sampler_average_latency(&sampler) == 3000);
+  CHECK(sampler.latency_max == 4000);
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.h"
+#include "h264.h"
+
+#include "platform.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAMES 120
+#define IDR_INTERVAL 60
+
+static long file_size(const char* path) {
+  FILE* fd = fopen(path, "rb");
+  CHECK(fd != NULL);
+  fseek(fd, 0, SEEK_END);
+  long size = ftell(fd);
+  fclose(fd);
+  return size;
+}
+
+static void feed(PDECODER_RENDERER_CALLBACKS callbacks, void* context) {
+  CHECK(callbacks->setup(VIDEO_FORMAT_H264, 1280, 720, 60, context, 0) == 0);
+  for (int n = 1; n <= FRAMES; n++)
+    CHECK(callbacks->submitDecodeUnit(test_stream_unit(n, n % IDR_INTERVAL == 1)) == DR_OK);
+  callbacks->cleanup();
+}
+
+static void test_dump(void) {
+  char dir[] = "/tmp/moonlight-dump-XXXXXX";
+  CHECK(mkdtemp(dir) != NULL);
+  char path[sizeof(dir) + sizeof("/stream.h264")];
+  char index_path[sizeof(path) + sizeof(".idx")];
+  snprintf(path, sizeof(path), "%s/stream.h264", dir);
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+  // the context is the output path, as set by video_dump
+  feed(&decoder_callbacks_dump, path);
+
+  // one index line per AU, packed back to back in the stream file
+  FILE* index_fd = fopen(index_path, "r");
+  CHECK(index_fd != NULL);
+  int number, sps, lines = 0, sps_lines = 0;
+  uint64_t receive, offset, expected = 0;
+  uint32_t length;
+  while (fscanf(index_fd, "%d %" SCNu64 " %" SCNu64 " %u %d", &number, &receive, &offset, &length, &sps) == 5) {
+    lines++;
+    CHECK(number == lines);
+    CHECK(receive == (uint64_t) (1000 + number * 16));
+    CHECK(offset == expected);
+    CHECK(sps == (number % IDR_INTERVAL == 1));
+    sps_lines += sps;
+    expected += length;
+  }
+  fclose(index_fd);
+  CHECK(lines == FRAMES && sps_lines == FRAMES / IDR_INTERVAL);
+  CHECK(file_size(path) == (long) expected);
+
+  // the stream starts with the rewritten SPS
+  FILE* fd = fopen(path, "rb");
+  unsigned char start[5];
+  CHECK(fread(start, 1, sizeof(start), fd) == sizeof(start));
+  fclose(fd);
+  CHECK(memcmp(start, "\0\0\0\1\x67", 5) == 0);
+
+  remove(path);
+  remove(index_path);
+  remove(dir);
+}
+
+int main(void) {
+  feed(&decoder_callbacks_null, NULL);
+  test_dump();
+  return 0;
+}
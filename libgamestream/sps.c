@@ -21,13 +21,39 @@
 
 #include "h264_stream.h"
 
+#include <string.h>
+
+// write_nal_unit is limited to 128 bytes, plus the start code
+#define SPS_FIXED_MAX (128 + 4)
+// larger SPS are still rewritten, just never cached
+#define SPS_CACHE_MAX 256
+
 static h264_stream_t* h264_stream = NULL;
 static int initial_width, initial_height;
+// level of the SPS as sent by the host, before the fixup touched it
+static int initial_level;
+
+// The SPS is the same for the whole session nearly every time, so keep the
+// last one and what it was rewritten to around.
+static struct {
+  uint8_t raw[SPS_CACHE_MAX];
+  int raw_length;
+  int flags;
+  uint8_t fixed[SPS_FIXED_MAX];
+  uint32_t fixed_length;
+} sps_cache;
+
+static void gs_sps_cache_reset() {
+  sps_cache.raw_length = -1;
+  sps_cache.fixed_length = 0;
+}
 
 void gs_sps_init(int width, int height) {
   h264_stream = h264_new();
   initial_width = width;
   initial_height = height;
+  initial_level = -1;
+  gs_sps_cache_reset();
 }
 
 void gs_sps_stop() {
@@ -35,11 +61,47 @@ void gs_sps_stop() {
     h264_free(h264_stream);
     h264_stream = NULL;
   }
+  gs_sps_cache_reset();
+}
+
+bool gs_sps_changed(PLENTRY sps, int* width, int* height) {
+  // the SPS the cache holds was compared already
+  if (sps->length == sps_cache.raw_length && memcmp(sps->data, sps_cache.raw, sps->length) == 0)
+    return false;
+
+  read_nal_unit(h264_stream, sps->data+4, sps->length-4);
+  sps_t* parsed = h264_stream->sps;
+
+  // cropping is in units of 2 luma samples for 4:2:0, doubled vertically for field coding
+  int frame_height_factor = 2 - parsed->frame_mbs_only_flag;
+  int new_width = (parsed->pic_width_in_mbs_minus1 + 1) * 16;
+  int new_height = (parsed->pic_height_in_map_units_minus1 + 1) * 16 * frame_height_factor;
+  if (parsed->frame_cropping_flag) {
+    new_width -= 2 * (parsed->frame_crop_left_offset + parsed->frame_crop_right_offset);
+    new_height -= 2 * frame_height_factor * (parsed->frame_crop_top_offset + parsed->frame_crop_bottom_offset);
+  }
+
+  bool changed = new_width != initial_width || new_height != initial_height ||
+                 (initial_level >= 0 && parsed->level_idc != initial_level);
+  initial_width = new_width;
+  initial_height = new_height;
+  initial_level = parsed->level_idc;
+
+  *width = new_width;
+  *height = new_height;
+  return changed;
 }
 
 void gs_sps_fix(PLENTRY sps, int flags, uint8_t* out_buf, uint32_t* out_offset) {
   const char naluHeader[] = {0x00, 0x00, 0x00, 0x01};
 
+  if (sps->length == sps_cache.raw_length && flags == sps_cache.flags &&
+      memcmp(sps->data, sps_cache.raw, sps->length) == 0) {
+    memcpy(out_buf+*out_offset, sps_cache.fixed, sps_cache.fixed_length);
+    *out_offset += sps_cache.fixed_length;
+    return;
+  }
+
   read_nal_unit(h264_stream, sps->data+4, sps->length-4);
 
   // Some decoders rely on H264 level to decide how many buffers are needed
@@ -82,8 +144,21 @@ void gs_sps_fix(PLENTRY sps, int flags, uint8_t* out_buf, uint32_t* out_offset)
   } else // Devices that didn't/couldn't get bitstream restrictions before GFE 2.5.11 will continue to not receive them now
     h264_stream->sps->vui.bitstream_restriction_flag = 0;
 
-  memcpy(out_buf+*out_offset, naluHeader, 4);
+  uint8_t* fixed = out_buf+*out_offset;
+  memcpy(fixed, naluHeader, 4);
   *out_offset += 4;
 
-  *out_offset += write_nal_unit(h264_stream, out_buf+*out_offset, 128);
+  int written = write_nal_unit(h264_stream, out_buf+*out_offset, 128);
+  *out_offset += written;
+
+  uint32_t fixed_length = out_buf+*out_offset - fixed;
+  if (written > 0 && sps->length <= SPS_CACHE_MAX && fixed_length <= SPS_FIXED_MAX) {
+    memcpy(sps_cache.raw, sps->data, sps->length);
+    sps_cache.raw_length = sps->length;
+    sps_cache.flags = flags;
+    memcpy(sps_cache.fixed, fixed, fixed_length);
+    sps_cache.fixed_length = fixed_length;
+  } else {
+    gs_sps_cache_reset();
+  }
 }
@@ -19,8 +19,15 @@
 
 #include <Limelight.h>
 
+#include <stdbool.h>
+
 #define GS_SPS_BITSTREAM_FIXUP 0x01
 
 void gs_sps_init(int width, int height);
 void gs_sps_stop();
 void gs_sps_fix(PLENTRY sps, int flags, uint8_t* out_buf, uint32_t* out_offset);
+
+// Check an SPS against the resolution and level the stream currently has.
+// On a change the new values are taken over, stored in width and height, and
+// true is returned.
+bool gs_sps_changed(PLENTRY sps, int* width, int* height);
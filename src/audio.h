@@ -24,3 +24,6 @@
 extern const char* audio_device;
 
 extern AUDIO_RENDERER_CALLBACKS audio_callbacks_vita;
+extern AUDIO_RENDERER_CALLBACKS audio_callbacks_null;
+extern AUDIO_RENDERER_CALLBACKS audio_callbacks_wav;
+extern AUDIO_RENDERER_CALLBACKS audio_callbacks_timing;
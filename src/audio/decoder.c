@@ -0,0 +1,160 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decoder.h"
+#include "downmix.h"
+
+#include <string.h>
+
+int audio_decoder_init(audio_decoder* decoder, const OPUS_MULTISTREAM_CONFIGURATION* config,
+                       audio_decoder_play play, audio_decoder_clock clock, void* context) {
+  memset(decoder, 0, sizeof(audio_decoder));
+  if (config->channelCount != 2 && config->channelCount != AUDIO_DECODER_SURROUND_CHANNELS)
+    return -1;
+
+  int rc;
+  decoder->opus = opus_multistream_decoder_create(config->sampleRate, config->channelCount, config->streams,
+                                                  config->coupledStreams, config->mapping, &rc);
+  if (rc < 0) {
+    decoder->opus = NULL;
+    return rc;
+  }
+
+  decoder->channels = config->channelCount;
+  decoder->streams = config->streams;
+  decoder->play = play;
+  decoder->clock = clock;
+  decoder->context = context;
+  decoder->last_frames = AUDIO_DECODER_PACKET_FRAMES;
+  return 0;
+}
+
+void audio_decoder_destroy(audio_decoder* decoder) {
+  if (decoder->opus != NULL) {
+    opus_multistream_decoder_destroy(decoder->opus);
+    decoder->opus = NULL;
+  }
+}
+
+// decode into pcm, downmixing 5.1 to stereo on the way
+static int audio_decoder_opus(audio_decoder* decoder, const char* data, int length, int frames, int fec) {
+  if (decoder->channels != AUDIO_DECODER_SURROUND_CHANNELS)
+    return opus_multistream_decode(decoder->opus, (const unsigned char*) data, length, decoder->pcm, frames, fec);
+
+  int decoded = opus_multistream_decode(decoder->opus, (const unsigned char*) data, length,
+                                        decoder->surround_pcm, frames, fec);
+  if (decoded > 0) {
+    uint64_t start = decoder->clock != NULL ? decoder->clock() : 0;
+    downmix_51_stereo(decoder->surround_pcm, decoder->pcm, decoded);
+    if (decoder->clock != NULL)
+      decoder->downmix_time += decoder->clock() - start;
+    decoder->downmix_frames += decoded;
+  }
+  return decoded;
+}
+
+// Whether the first stream of a packet carries LBRR data, the in-band FEC
+// for the packet before it. Does what opus_packet_has_lbrr does, which
+// libopus only has since 1.5, but also for the self-delimited first stream
+// of a multistream packet.
+static bool audio_decoder_has_lbrr(audio_decoder* decoder, const unsigned char* packet, int length) {
+  if (length < 1)
+    return false;
+
+  // only SILK and hybrid frames carry LBRR, CELT only ones don't
+  int config = packet[0] >> 3;
+  if (config >= 16)
+    return false;
+
+  // the first frame follows the TOC byte, the size of the first frame for
+  // code 2 and the size of the last one for a self-delimited stream; code 3
+  // has a frame count and padding first, which the host doesn't send
+  if ((packet[0] & 0x3) == 3)
+    return false;
+  int offset = 1;
+  int sizes = ((packet[0] & 0x3) == 2) + (decoder->streams > 1);
+  for (int i = 0; i < sizes; i++) {
+    if (offset >= length)
+      return false;
+    offset += packet[offset] < 252 ? 1 : 2;
+  }
+  if (offset >= length)
+    return false;
+
+  // the SILK header opens the frame: a VAD flag for each 20 ms frame, then
+  // the LBRR flag, for the mid and for a stereo stream the side channel
+  int frames = config < 12 && (config & 0x3) >= 2 ? (config & 0x3) : 1;
+  bool stereo = packet[0] & 0x4;
+  uint8_t header = packet[offset];
+  return (header >> (7 - frames) & 0x1) || (stereo && (header >> (6 - 2 * frames) & 0x1));
+}
+
+// Fill in a lost packet. With the packet after it at hand, its in-band FEC
+// is used, otherwise the decoder conceals the loss.
+static void audio_decoder_conceal(audio_decoder* decoder, const char* next, int length) {
+  int decoded = audio_decoder_opus(decoder, next, next ? length : 0, decoder->last_frames, next != NULL);
+  if (decoded <= 0 && next != NULL) {
+    next = NULL;
+    decoded = audio_decoder_opus(decoder, NULL, 0, decoder->last_frames, 0);
+  }
+  if (decoded <= 0) {
+    decoder->errors++;
+    decoder->last_error = decoded;
+    return;
+  }
+
+  // without LBRR data in it the decoder concealed the loss from the next packet
+  if (next != NULL && audio_decoder_has_lbrr(decoder, (const unsigned char*) next, length)) {
+    decoder->fec++;
+  } else {
+    decoder->concealed++;
+  }
+  decoder->play(decoder->context, decoder->pcm, decoded, true);
+}
+
+void audio_decoder_packet(audio_decoder* decoder, const char* data, int length) {
+  if (data == NULL) {
+    // wait for the next packet to see if it carries this one, only one loss
+    // can be recovered that way so earlier ones are concealed right away
+    if (decoder->loss_pending) {
+      audio_decoder_conceal(decoder, NULL, 0);
+    }
+    decoder->loss_pending = true;
+    return;
+  }
+
+  if (decoder->loss_pending) {
+    decoder->loss_pending = false;
+    audio_decoder_conceal(decoder, data, length);
+  }
+
+  decoder->packets++;
+  int decoded = audio_decoder_opus(decoder, data, length, AUDIO_DECODER_MAX_FRAMES, 0);
+  if (decoded > 0) {
+    if (decoded != AUDIO_DECODER_PACKET_FRAMES)
+      decoder->odd_sized++;
+    decoder->last_frames = decoded;
+    decoder->play(decoder->context, decoder->pcm, decoded, false);
+  } else {
+    // keep the timing, play concealment in its place
+    decoder->errors++;
+    decoder->last_error = decoded;
+    audio_decoder_conceal(decoder, NULL, 0);
+  }
+}
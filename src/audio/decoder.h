@@ -0,0 +1,86 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+#include <opus/opus_multistream.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Opus multistream decode of the audio stream, the part every audio
+// renderer shares.
+//
+// Packets go in as they are received, NULL for a lost one. A lost packet
+// is held back until the next one arrives, whose in-band FEC can restore
+// it; without that (or after more than one loss in a row) the decoder
+// conceals it. Only a next packet that carries LBRR data counts as FEC,
+// otherwise decoding with it is concealment all the same. 5.1 is downmixed to stereo, so the output is always
+// interleaved stereo and goes to the play callback, concealed audio
+// included.
+//
+// The clock is only used to time the downmix, it may be NULL.
+
+// longest packet Opus can carry, 120 ms
+#define AUDIO_DECODER_MAX_FRAMES 5760
+// packets are this long unless the host was asked otherwise
+#define AUDIO_DECODER_PACKET_FRAMES 240
+#define AUDIO_DECODER_SURROUND_CHANNELS 6
+
+// lost is true for audio made up for a lost packet
+typedef void (*audio_decoder_play)(void* context, const short* pcm, int frames, bool lost);
+typedef uint64_t (*audio_decoder_clock)(void);
+
+typedef struct {
+  OpusMSDecoder* opus;
+  int channels;
+  int streams;
+  audio_decoder_play play;
+  audio_decoder_clock clock;
+  void* context;
+
+  // a packet was lost and the one after it may carry it as in-band FEC
+  bool loss_pending;
+  // duration of the last packet, a lost one is assumed to be as long
+  int last_frames;
+
+  short pcm[2 * AUDIO_DECODER_MAX_FRAMES];
+  // 5.1 streams are decoded here and downmixed into pcm
+  short surround_pcm[AUDIO_DECODER_SURROUND_CHANNELS * AUDIO_DECODER_MAX_FRAMES] __attribute__((aligned(16)));
+
+  // counters, reset by audio_decoder_init
+  uint32_t packets;
+  uint32_t concealed;
+  uint32_t fec;
+  uint32_t odd_sized;
+  uint32_t errors;
+  int last_error;
+  uint64_t downmix_frames;
+  uint64_t downmix_time;
+} audio_decoder;
+
+// returns an Opus error code if the decoder can't be created, or -1 if the
+// channel layout isn't supported
+int audio_decoder_init(audio_decoder* decoder, const OPUS_MULTISTREAM_CONFIGURATION* config,
+                       audio_decoder_play play, audio_decoder_clock clock, void* context);
+void audio_decoder_destroy(audio_decoder* decoder);
+
+// data is NULL for a lost packet
+void audio_decoder_packet(audio_decoder* decoder, const char* data, int length);
@@ -0,0 +1,114 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "downmix.h"
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DOWNMIX_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DOWNMIX_SSE2
+#endif
+
+static inline short downmix_clamp(int32_t sum) {
+  sum >>= 16;
+  if (sum > INT16_MAX)
+    return INT16_MAX;
+  if (sum < INT16_MIN)
+    return INT16_MIN;
+  return sum;
+}
+
+void downmix_51_stereo_scalar(const short* in, short* out, int frames) {
+  for (int i = 0; i < frames; i++, in += 6, out += 2) {
+    int32_t center = in[2] * DOWNMIX_GAIN_SIDE;
+    out[0] = downmix_clamp(in[0] * DOWNMIX_GAIN_FRONT + center + in[4] * DOWNMIX_GAIN_SIDE);
+    out[1] = downmix_clamp(in[1] * DOWNMIX_GAIN_FRONT + center + in[5] * DOWNMIX_GAIN_SIDE);
+  }
+}
+
+#if defined(DOWNMIX_NEON)
+
+void downmix_51_stereo(const short* in, short* out, int frames) {
+  int i = 0;
+  for (; i + 4 <= frames; i += 4, in += 24, out += 8) {
+    // each frame as three channel pairs: FL FR, FC LFE, RL RR
+    int32x4x3_t pairs = vld3q_s32((const int32_t*) in);
+    int16x8_t front = vreinterpretq_s16_s32(pairs.val[0]);
+    int16x8_t center = vreinterpretq_s16_s32(pairs.val[1]);
+    int16x8_t rear = vreinterpretq_s16_s32(pairs.val[2]);
+    // FC LFE -> FC FC
+    center = vtrnq_s16(center, center).val[0];
+
+    int32x4_t low = vmull_n_s16(vget_low_s16(front), DOWNMIX_GAIN_FRONT);
+    low = vmlal_n_s16(low, vget_low_s16(center), DOWNMIX_GAIN_SIDE);
+    low = vmlal_n_s16(low, vget_low_s16(rear), DOWNMIX_GAIN_SIDE);
+    int32x4_t high = vmull_n_s16(vget_high_s16(front), DOWNMIX_GAIN_FRONT);
+    high = vmlal_n_s16(high, vget_high_s16(center), DOWNMIX_GAIN_SIDE);
+    high = vmlal_n_s16(high, vget_high_s16(rear), DOWNMIX_GAIN_SIDE);
+
+    vst1q_s16(out, vcombine_s16(vqshrn_n_s32(low, 16), vqshrn_n_s32(high, 16)));
+  }
+  downmix_51_stereo_scalar(in, out, frames - i);
+}
+
+#elif defined(DOWNMIX_SSE2)
+
+// L and R sums of two frames, as L0 R0 L1 R1
+static inline __m128i downmix_sse2_pair(const short* in, __m128i left, __m128i right) {
+  __m128i first = _mm_loadu_si128((const __m128i*) in);
+  __m128i second = _mm_loadu_si128((const __m128i*) (in + 6));
+
+  // products in 32 bit lanes, the pairwise adds only ever add a zero
+  __m128i l0 = _mm_madd_epi16(first, left);
+  __m128i r0 = _mm_madd_epi16(first, right);
+  __m128i l1 = _mm_madd_epi16(second, left);
+  __m128i r1 = _mm_madd_epi16(second, right);
+
+  // horizontal sums of all four
+  __m128i a = _mm_add_epi32(_mm_unpacklo_epi32(l0, r0), _mm_unpackhi_epi32(l0, r0));
+  __m128i b = _mm_add_epi32(_mm_unpacklo_epi32(l1, r1), _mm_unpackhi_epi32(l1, r1));
+  return _mm_add_epi32(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+}
+
+void downmix_51_stereo(const short* in, short* out, int frames) {
+  const __m128i left = _mm_setr_epi16(DOWNMIX_GAIN_FRONT, 0, DOWNMIX_GAIN_SIDE, 0, DOWNMIX_GAIN_SIDE, 0, 0, 0);
+  const __m128i right = _mm_setr_epi16(0, DOWNMIX_GAIN_FRONT, DOWNMIX_GAIN_SIDE, 0, 0, DOWNMIX_GAIN_SIDE, 0, 0);
+
+  int i = 0;
+  // every frame is loaded as 8 samples, keep the last ones for the scalar
+  // loop so nothing is read past the end of in
+  for (; i + 5 <= frames; i += 4, in += 24, out += 8) {
+    __m128i low = _mm_srai_epi32(downmix_sse2_pair(in, left, right), 16);
+    __m128i high = _mm_srai_epi32(downmix_sse2_pair(in + 12, left, right), 16);
+    _mm_storeu_si128((__m128i*) out, _mm_packs_epi32(low, high));
+  }
+  downmix_51_stereo_scalar(in, out, frames - i);
+}
+
+#else
+
+void downmix_51_stereo(const short* in, short* out, int frames) {
+  downmix_51_stereo_scalar(in, out, frames);
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// 5.1 to stereo downmix.
+//
+// Input frames are six interleaved channels in the order the host sends
+// them: FL FR FC LFE RL RR. The LFE channel is dropped, the center goes to
+// both sides and each surround channel to its own side, both at -3 dB
+// relative to the fronts. The gains are scaled so a full scale signal on
+// all channels can't clip:
+//
+//   L = 0.414 FL + 0.293 FC + 0.293 RL
+//   R = 0.414 FR + 0.293 FC + 0.293 RR
+//
+// Gains are Q16 fixed point and the sums are truncated and saturated to
+// 16 bits, so the NEON and SSE2 versions give exactly the same output as the
+// scalar one.
+
+#define DOWNMIX_GAIN_FRONT 27146
+#define DOWNMIX_GAIN_SIDE 19194
+
+// downmix frames frames from in into interleaved stereo out, with the widest
+// SIMD the target has
+void downmix_51_stereo(const short* in, short* out, int frames);
+
+// plain C reference
+void downmix_51_stereo_scalar(const short* in, short* out, int frames);
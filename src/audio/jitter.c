@@ -0,0 +1,190 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jitter.h"
+
+#include <string.h>
+
+// the jitter estimate follows 1/16 of every new deviation
+#define JITTER_SMOOTHING 16
+// the peak loses 1/JITTER_PEAK_DECAY per packet, about 1/4 per second for 5 ms packets
+#define JITTER_PEAK_DECAY 512
+// and never sits below this multiple of the jitter estimate
+#define JITTER_PEAK_FACTOR 3
+// longer gaps are a paused stream, not jitter
+#define JITTER_PAUSE 500000
+// the depth error alone is worked off within this many seconds
+#define JITTER_TRACKING 2
+// and what stays behind of it within this many times as long
+#define JITTER_SETTLING 32
+// ppm the accumulated error may add on top of the drift estimate
+#define JITTER_MAX_DRIFT 2000
+
+int jitter_init(jitter_buffer* jitter, uint32_t sample_rate, uint32_t capacity,
+                uint32_t min_target, uint32_t max_target) {
+  memset(jitter, 0, sizeof(jitter_buffer));
+  if (pcm_ring_init(&jitter->ring, capacity) < 0)
+    return -1;
+
+  jitter->sample_rate = sample_rate;
+  jitter->min_target = min_target;
+  jitter->max_target = max_target < capacity / 2 ? max_target : capacity / 2;
+  jitter->target = min_target;
+  return 0;
+}
+
+void jitter_destroy(jitter_buffer* jitter) {
+  pcm_ring_destroy(&jitter->ring);
+}
+
+void jitter_arrival(jitter_buffer* jitter, uint32_t frames, uint64_t now) {
+  jitter->packets++;
+  if (jitter->last_arrival != 0 && now > jitter->last_arrival && now - jitter->last_arrival < JITTER_PAUSE) {
+    // how far this packet is off from arriving one packet duration after the
+    // previous one
+    int64_t expected = (uint64_t) jitter->last_frames * 1000000 / jitter->sample_rate;
+    int64_t deviation = (int64_t) (now - jitter->last_arrival) - expected;
+    uint32_t magnitude = deviation < 0 ? -deviation : deviation;
+
+    jitter->jitter += ((int64_t) magnitude - jitter->jitter) / JITTER_SMOOTHING;
+    jitter->peak -= jitter->peak / JITTER_PEAK_DECAY;
+    if (magnitude > jitter->peak)
+      jitter->peak = magnitude;
+    if (jitter->peak < jitter->jitter * JITTER_PEAK_FACTOR)
+      jitter->peak = jitter->jitter * JITTER_PEAK_FACTOR;
+
+    uint32_t target = (uint64_t) jitter->peak * jitter->sample_rate / 1000000;
+    if (target < jitter->min_target)
+      target = jitter->min_target;
+    if (target > jitter->max_target)
+      target = jitter->max_target;
+    __atomic_store_n(&jitter->target, target, __ATOMIC_RELAXED);
+  }
+  jitter->last_arrival = now;
+  jitter->last_frames = frames;
+}
+
+void jitter_lost(jitter_buffer* jitter, uint32_t frames) {
+  jitter->lost++;
+  jitter->last_frames += frames;
+}
+
+void jitter_write(jitter_buffer* jitter, const short* pcm, uint32_t frames) {
+  // the reader is too far behind, whatever doesn't fit is dropped
+  if (pcm_ring_write(&jitter->ring, pcm, frames) < frames)
+    __atomic_add_fetch(&jitter->overruns, 1, __ATOMIC_RELAXED);
+}
+
+void jitter_set_drift(jitter_buffer* jitter, int32_t drift) {
+  __atomic_store_n(&jitter->drift, drift, __ATOMIC_RELAXED);
+}
+
+// resampling ratio in ppm for a block of frames that leaves error frames
+// more than the target in the buffer
+static int32_t jitter_control(jitter_buffer* jitter, int32_t error, uint32_t frames) {
+  int64_t rate = jitter->sample_rate;
+
+  int32_t proportional = (int64_t) error * 1000000 / (rate * JITTER_TRACKING);
+
+  // Only errors close to the target are accumulated: a large one comes from
+  // priming or a burst and is gone soon, it mustn't wind up the part that
+  // is meant to track drift.
+  int64_t scale = rate * rate * JITTER_TRACKING * JITTER_SETTLING / 1000000;
+  if (proportional <= JITTER_MAX_DRIFT && proportional >= -JITTER_MAX_DRIFT) {
+    int64_t integral = jitter->integral + (int64_t) error * frames;
+    if (integral / scale <= JITTER_MAX_DRIFT && integral / scale >= -JITTER_MAX_DRIFT)
+      jitter->integral = integral;
+  }
+  int32_t accumulated = jitter->integral / scale;
+
+  int32_t ratio = __atomic_load_n(&jitter->drift, __ATOMIC_RELAXED) + proportional + accumulated;
+  int32_t limit = 1000000 / JITTER_MAX_STRETCH;
+  if (ratio > limit)
+    ratio = limit;
+  if (ratio < -limit)
+    ratio = -limit;
+  __atomic_store_n(&jitter->ratio, ratio, __ATOMIC_RELAXED);
+  return ratio;
+}
+
+bool jitter_read(jitter_buffer* jitter, short* out, uint32_t frames) {
+  pcm_ring* ring = &jitter->ring;
+  uint32_t count = pcm_ring_count(ring);
+  uint32_t target = __atomic_load_n(&jitter->target, __ATOMIC_RELAXED);
+
+  if (!jitter->playing) {
+    if (count < target + frames)
+      return false;
+    jitter->playing = true;
+    jitter->phase = 0;
+  }
+
+  // a burst left far more than the target, don't carry that latency around
+  if (count > target * 2 + frames * 2) {
+    uint32_t excess = count - target - frames;
+    pcm_ring_advance(ring, excess);
+    count -= excess;
+    __atomic_add_fetch(&jitter->overruns, 1, __ATOMIC_RELAXED);
+  }
+
+  // read positions in 32.32 fixed point, relative to the oldest frame
+  int32_t ratio = jitter_control(jitter, (int32_t) count - (int32_t) frames - (int32_t) target, frames);
+  uint64_t step = (1ULL << 32) + (int64_t) ratio * (1LL << 32) / 1000000;
+  uint64_t position = jitter->phase;
+  uint64_t end = position + step * frames;
+
+  if ((end >> 32) > count) {
+    if (count + frames / JITTER_MAX_STRETCH < frames) {
+      jitter->playing = false;
+      jitter->underruns++;
+      return false;
+    }
+    // just short, spread what is left over the block
+    step = ((uint64_t) count << 32) / frames;
+    position = 0;
+    end = step * frames;
+  }
+  uint32_t consume = end >> 32;
+
+  // linear interpolation between the two frames around each position
+  for (uint32_t i = 0; i < frames; i++, position += step) {
+    uint32_t index = position >> 32;
+    // 15 bits, so the product with a difference of two samples fits
+    int32_t fraction = (position >> 17) & 0x7fff;
+    uint32_t next = index + 1 < count ? index + 1 : index;
+    for (int c = 0; c < JITTER_CHANNELS; c++) {
+      int32_t a = pcm_ring_sample(ring, index, c);
+      int32_t b = pcm_ring_sample(ring, next, c);
+      out[i * JITTER_CHANNELS + c] = a + (((b - a) * fraction) >> 15);
+    }
+  }
+
+  if (consume > frames)
+    jitter->compressed += consume - frames;
+  else
+    jitter->stretched += frames - consume;
+
+  jitter->phase = (uint32_t) end;
+  pcm_ring_advance(ring, consume);
+  return true;
+}
+
+uint32_t jitter_depth(jitter_buffer* jitter) {
+  return pcm_ring_count(&jitter->ring);
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pcm_ring.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Jitter buffer for decoded stereo PCM.
+//
+// Packets are timed as they arrive. The spread of their inter-arrival times
+// against the nominal packet duration gives the jitter, and a peak of it
+// that only decays slowly sets the target depth: the audio that should
+// still be buffered after a block was taken out for playback. Playback
+// starts once the target plus one block is buffered.
+//
+// Reads resample the audio by a fractional ratio that keeps the buffer at
+// the target. It is made of the clock drift between the host and the port,
+// as far as it is known (jitter_set_drift), and a PI controller on the
+// depth error that covers whatever the drift estimate misses as well as
+// target changes. The read position keeps its fraction from one block to the
+// next, so block edges are as smooth as the rest.
+//
+// An underrun (not enough audio for a block) stops playback until the
+// buffer is primed again. An overrun (a burst filled the buffer far past the
+// target, or all the way) drops audio to get back to the target.
+//
+// The audio sits in a pcm_ring, so one thread can arrive and write while
+// another one reads. Times are in microseconds and passed in by the caller,
+// so there are no platform dependencies.
+
+#define JITTER_CHANNELS PCM_RING_CHANNELS
+// playback is sped up or slowed down by at most 1/JITTER_MAX_STRETCH
+#define JITTER_MAX_STRETCH 50
+
+typedef struct {
+  pcm_ring ring;
+  uint32_t sample_rate;
+
+  // arrival statistics, writer side
+  uint64_t last_arrival;
+  uint32_t last_frames;
+  uint32_t jitter;
+  uint32_t peak;
+  uint32_t min_target;
+  uint32_t max_target;
+  // read by the reader side as well
+  uint32_t target;
+
+  // reader side
+  bool playing;
+  int32_t drift;
+  // fraction of a frame the read position is past the oldest frame, 0.32
+  uint32_t phase;
+  int64_t integral;
+  // ppm the last block was resampled by, read by anyone
+  int32_t ratio;
+
+  // counters, reset by jitter_init
+  uint32_t packets;
+  uint32_t lost;
+  uint32_t underruns;
+  uint32_t overruns;
+  uint64_t stretched;
+  uint64_t compressed;
+} jitter_buffer;
+
+// capacity and targets are in frames (one sample per channel), the capacity
+// is rounded up to a power of two
+int jitter_init(jitter_buffer* jitter, uint32_t sample_rate, uint32_t capacity,
+                uint32_t min_target, uint32_t max_target);
+void jitter_destroy(jitter_buffer* jitter);
+
+// a packet of frames arrived at now
+void jitter_arrival(jitter_buffer* jitter, uint32_t frames, uint64_t now);
+// a packet of frames was lost, the next arrival is that much later
+void jitter_lost(jitter_buffer* jitter, uint32_t frames);
+
+// writer side
+void jitter_write(jitter_buffer* jitter, const short* pcm, uint32_t frames);
+
+// Reader side. How much faster, in ppm, audio is written than read in the
+// long run; safe to call from any thread.
+void jitter_set_drift(jitter_buffer* jitter, int32_t drift);
+// Fill out with a block of frames. Returns false if the buffer isn't primed
+// or ran dry, out is left untouched then.
+bool jitter_read(jitter_buffer* jitter, short* out, uint32_t frames);
+
+uint32_t jitter_depth(jitter_buffer* jitter);
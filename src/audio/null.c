@@ -0,0 +1,94 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../audio.h"
+#include "decoder.h"
+
+#include <Limelight.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Decodes every packet the way the Vita renderer does, loss concealment and
+// downmix included, and throws the audio away. Useful to measure what
+// decoding costs without any audio output in the way.
+
+static audio_decoder decoder;
+static uint64_t frames, lost_frames, decode_time, decode_max;
+
+static uint64_t null_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void null_play(void* context, const short* pcm, int count, bool lost) {
+  (void) context;
+  (void) pcm;
+  frames += count;
+  if (lost)
+    lost_frames += count;
+}
+
+static int null_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
+  (void) audioConfiguration;
+  (void) context;
+  (void) arFlags;
+  frames = lost_frames = decode_time = decode_max = 0;
+  int rc = audio_decoder_init(&decoder, opusConfig, null_play, null_clock, NULL);
+  if (rc < 0) {
+    printf("null audio: can't decode %d channels: %d\n", opusConfig->channelCount, rc);
+    return -1;
+  }
+  printf("null audio setup %d channels at %d Hz\n", opusConfig->channelCount, opusConfig->sampleRate);
+  return 0;
+}
+
+static void null_cleanup() {
+  if (decoder.opus == NULL)
+    return;
+
+  printf("null audio: %u packets, %" PRIu64 " frames, %" PRIu64 " made up (%u concealed, %u from FEC), %u errors\n",
+         decoder.packets, frames, lost_frames, decoder.concealed, decoder.fec, decoder.errors);
+  if (decoder.packets > 0)
+    printf("null audio: decode avg %" PRIu64 " max %" PRIu64 " us per packet\n", decode_time / decoder.packets, decode_max);
+  if (decoder.downmix_frames > 0)
+    printf("null audio: downmix %" PRIu64 " ns per %d samples\n",
+           decoder.downmix_time * 1000 * AUDIO_DECODER_PACKET_FRAMES / decoder.downmix_frames,
+           AUDIO_DECODER_PACKET_FRAMES);
+  audio_decoder_destroy(&decoder);
+}
+
+static void null_decode_and_play_sample(char* data, int length) {
+  uint64_t start = null_clock();
+  audio_decoder_packet(&decoder, data, length);
+  uint64_t elapsed = null_clock() - start;
+  decode_time += elapsed;
+  if (elapsed > decode_max)
+    decode_max = elapsed;
+}
+
+AUDIO_RENDERER_CALLBACKS audio_callbacks_null = {
+  .init = null_init,
+  .cleanup = null_cleanup,
+  .decodeAndPlaySample = null_decode_and_play_sample,
+  .capabilities = CAPABILITY_DIRECT_SUBMIT,
+};
@@ -0,0 +1,68 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcm_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int pcm_ring_init(pcm_ring* ring, uint32_t capacity) {
+  memset(ring, 0, sizeof(pcm_ring));
+  uint32_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+
+  ring->samples = malloc(size * PCM_RING_CHANNELS * sizeof(short));
+  if (ring->samples == NULL)
+    return -1;
+  ring->capacity = size;
+  ring->mask = size - 1;
+  return 0;
+}
+
+void pcm_ring_destroy(pcm_ring* ring) {
+  if (ring->samples != NULL) {
+    free(ring->samples);
+    ring->samples = NULL;
+  }
+}
+
+uint32_t pcm_ring_write(pcm_ring* ring, const short* pcm, uint32_t frames) {
+  uint32_t read = __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE);
+  uint32_t write = ring->write;
+  uint32_t room = ring->capacity - (write - read);
+  if (frames > room)
+    frames = room;
+
+  uint32_t start = write & ring->mask;
+  uint32_t first = frames < ring->capacity - start ? frames : ring->capacity - start;
+  memcpy(ring->samples + start * PCM_RING_CHANNELS, pcm, first * PCM_RING_CHANNELS * sizeof(short));
+  memcpy(ring->samples, pcm + first * PCM_RING_CHANNELS, (frames - first) * PCM_RING_CHANNELS * sizeof(short));
+
+  __atomic_store_n(&ring->write, write + frames, __ATOMIC_RELEASE);
+  return frames;
+}
+
+uint32_t pcm_ring_count(pcm_ring* ring) {
+  return __atomic_load_n(&ring->write, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->read, __ATOMIC_RELAXED);
+}
+
+void pcm_ring_advance(pcm_ring* ring, uint32_t frames) {
+  __atomic_store_n(&ring->read, ring->read + frames, __ATOMIC_RELEASE);
+}
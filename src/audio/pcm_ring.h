@@ -0,0 +1,56 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Lock-free single producer, single consumer ring of interleaved PCM frames.
+//
+// The producer only ever moves the write position and the consumer only the
+// read position, both are free running counters. The producer never
+// overwrites frames that weren't consumed: a write into a full ring is cut
+// short instead. No platform dependencies.
+
+#define PCM_RING_CHANNELS 2
+
+typedef struct {
+  short* samples;
+  uint32_t capacity;
+  uint32_t mask;
+  uint32_t write;
+  uint32_t read;
+} pcm_ring;
+
+// capacity in frames is rounded up to a power of two
+int pcm_ring_init(pcm_ring* ring, uint32_t capacity);
+void pcm_ring_destroy(pcm_ring* ring);
+
+// producer: returns the number of frames that fit
+uint32_t pcm_ring_write(pcm_ring* ring, const short* pcm, uint32_t frames);
+
+// consumer: frames that can be read
+uint32_t pcm_ring_count(pcm_ring* ring);
+// consumer: done with the oldest frames
+void pcm_ring_advance(pcm_ring* ring, uint32_t frames);
+
+// consumer: a sample of the frame offset frames past the read position
+static inline short pcm_ring_sample(pcm_ring* ring, uint32_t offset, int channel) {
+  return ring->samples[((ring->read + offset) & ring->mask) * PCM_RING_CHANNELS + channel];
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../audio.h"
+#include "decoder.h"
+#include "jitter.h"
+
+#include <Limelight.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Decodes every packet like the Vita renderer, but instead of the audio it
+// keeps a text log with one line per packet:
+//   arrival (us since the first packet), decode time (us), frames decoded,
+//   frames made up for lost packets
+//
+// The decoded audio goes through a jitter buffer that is read in real time
+// by the arrival clock, one block per TIMING_BLOCK frames, the way the Vita
+// output thread reads it. Its counters at the end show what the real one
+// would have done with the same network.
+
+#define TIMING_BLOCK 960
+// the same limits the Vita renderer runs with
+#define TIMING_JITTER_CAPACITY 9600
+#define TIMING_JITTER_MIN_TARGET 240
+#define TIMING_JITTER_MAX_TARGET 4800
+
+static FILE* fd = NULL;
+static const char* fileName = "ux0:data/moonlight/audio_timing.txt";
+static audio_decoder decoder;
+static jitter_buffer jitter = {0};
+static short block[2 * TIMING_BLOCK];
+
+static uint64_t first_arrival, arrival, played_until;
+static uint32_t sample_rate;
+static uint32_t packet_frames, packet_lost;
+static uint64_t decode_time, decode_max;
+static uint32_t blocks, silent_blocks;
+
+static uint64_t timing_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void timing_play(void* context, const short* pcm, int frames, bool lost) {
+  (void) context;
+  if (lost) {
+    jitter_lost(&jitter, frames);
+    packet_lost += frames;
+  } else {
+    jitter_arrival(&jitter, frames, arrival);
+    packet_frames += frames;
+  }
+  jitter_write(&jitter, pcm, frames);
+}
+
+// play every block that would have been due by now
+static void timing_output(uint64_t now) {
+  uint64_t duration = (uint64_t) TIMING_BLOCK * 1000000 / sample_rate;
+  while (played_until + duration <= now) {
+    blocks++;
+    if (!jitter_read(&jitter, block, TIMING_BLOCK))
+      silent_blocks++;
+    played_until += duration;
+  }
+}
+
+static void timing_cleanup() {
+  if (fd != NULL) {
+    fclose(fd);
+    fd = NULL;
+  }
+  if (decoder.opus != NULL) {
+    printf("timing audio: %u packets, %u concealed, %u from FEC, %u errors\n",
+           decoder.packets, decoder.concealed, decoder.fec, decoder.errors);
+    if (decoder.packets > 0)
+      printf("timing audio: decode avg %" PRIu64 " max %" PRIu64 " us per packet\n", decode_time / decoder.packets, decode_max);
+    audio_decoder_destroy(&decoder);
+  }
+  if (jitter.ring.samples != NULL) {
+    printf("timing audio: %u blocks, %u silent, jitter %u us, target %u frames, %u underruns, %u overruns, "
+           "%" PRIu64 " stretched, %" PRIu64 " compressed, resampling by %d ppm\n",
+           blocks, silent_blocks, jitter.jitter, jitter.target, jitter.underruns, jitter.overruns,
+           jitter.stretched, jitter.compressed, jitter.ratio);
+    jitter_destroy(&jitter);
+  }
+}
+
+static int timing_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
+  (void) audioConfiguration;
+  (void) arFlags;
+  const char* path = context != NULL ? context : fileName;
+  first_arrival = played_until = 0;
+  decode_time = decode_max = 0;
+  blocks = silent_blocks = 0;
+  sample_rate = opusConfig->sampleRate;
+
+  int rc = audio_decoder_init(&decoder, opusConfig, timing_play, timing_clock, NULL);
+  if (rc < 0) {
+    printf("timing audio: can't decode %d channels: %d\n", opusConfig->channelCount, rc);
+    return -1;
+  }
+  if (jitter_init(&jitter, sample_rate, TIMING_JITTER_CAPACITY, TIMING_JITTER_MIN_TARGET,
+                  TIMING_JITTER_MAX_TARGET) < 0) {
+    printf("timing audio: not enough memory\n");
+    timing_cleanup();
+    return -1;
+  }
+
+  fd = fopen(path, "w");
+  if (fd == NULL) {
+    printf("timing audio: can't open %s\n", path);
+    timing_cleanup();
+    return -1;
+  }
+
+  printf("timing audio %d channels at %d Hz to %s\n", opusConfig->channelCount, sample_rate, path);
+  return 0;
+}
+
+static void timing_decode_and_play_sample(char* data, int length) {
+  arrival = timing_clock();
+  if (first_arrival == 0)
+    first_arrival = played_until = arrival;
+  timing_output(arrival);
+
+  packet_frames = packet_lost = 0;
+  audio_decoder_packet(&decoder, data, length);
+  uint64_t elapsed = timing_clock() - arrival;
+  decode_time += elapsed;
+  if (elapsed > decode_max)
+    decode_max = elapsed;
+
+  fprintf(fd, "%" PRIu64 " %" PRIu64 " %u %u\n", arrival - first_arrival, elapsed,
+          packet_frames, packet_lost);
+}
+
+AUDIO_RENDERER_CALLBACKS audio_callbacks_timing = {
+  .init = timing_init,
+  .cleanup = timing_cleanup,
+  .decodeAndPlaySample = timing_decode_and_play_sample,
+  .capabilities = CAPABILITY_DIRECT_SUBMIT,
+};
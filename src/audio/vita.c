@@ -18,50 +18,239 @@
  */
 
 #include "../audio.h"
+#include "../config.h"
+#include "../connection.h"
 #include "../debug.h"
+#include "../media_queue.h"
+#include "decoder.h"
+#include "jitter.h"
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <opus/opus_multistream.h>
 #include <psp2/audioout.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
 
 enum {
   VITA_AUDIO_INIT_OK        = 0,
   VITA_AUDIO_ERROR_BAD_OPUS = 0x80020001,
   VITA_AUDIO_ERROR_PORT     = 0x80020002,
+  VITA_AUDIO_ERROR_THREAD   = 0x80020003,
 };
 
-#define FRAME_SIZE 240
-#define VITA_SAMPLES 960
-#define BUFFER_SIZE (2 * VITA_SAMPLES)
-static int decode_offset;
+// output block sizes the port is opened with, 5, 10 or 20 ms; smaller
+// blocks cut latency at the cost of more wakeups
+#define VITA_SAMPLES_MIN 240
+#define VITA_SAMPLES_MAX 960
+#define BUFFER_SIZE (2 * VITA_SAMPLES_MAX)
 static int port;
+static int grain = VITA_SAMPLES_MAX;
 
 static int active_audio_thread = true;
-static OpusMSDecoder* decoder = NULL;
+static audio_decoder decoder = {0};
+// arrival time of the packet being decoded
+static uint64_t packet_arrival;
 
 static short buffer[BUFFER_SIZE];
 
+// in frames at 48 kHz: 200 ms of room, 5 to 100 ms kept buffered
+#define JITTER_CAPACITY 9600
+#define JITTER_MIN_TARGET 240
+#define JITTER_MAX_TARGET 4800
+
+static jitter_buffer jitter = {0};
+
+// Decoded audio is played by a thread of its own, sceAudioOutOutput blocks
+// until the port has room and must not hold up receiving or decoding. It
+// runs ahead of everything else, a late block is an audible click.
+#define OUTPUT_THREAD_PRIORITY 64
+
+static bool active_output_thread = false;
+static SceUID output_thread = -1;
+static SceUID output_sema = -1;
+
+// what the chosen grain costs: time a block spends buffered after it was
+// handed to the port, and time the output thread spends per block outside of
+// sceAudioOutOutput
+static struct {
+  uint32_t blocks;
+  uint64_t latency_total;
+  uint32_t latency_max;
+  uint64_t busy;
+  uint64_t start;
+} output_stats;
+
+// Queued mode: packets are copied into the queue and decoded by a thread of
+// our own
+#define AUDIO_QUEUE_SIZE 16
+#define AUDIO_PACKET_SIZE 1400
+
+static bool queued_decode = false;
+static bool active_decode_thread = false;
+static SceUID decode_thread = -1;
+static media_queue decode_queue;
+
+static void vita_renderer_decode(char* data, int length, uint64_t arrival);
+
+static int vita_decode_thread_main(SceSize args, void *argp) {
+  static char packet[AUDIO_PACKET_SIZE];
+  // wake up now and then even without packets so cleanup isn't held up
+  SceUInt timeout = 100000;
+  while (active_decode_thread) {
+    media_item item;
+    if (media_queue_pop(&decode_queue, &item, packet, timeout)) {
+      // packets the queue dropped are lost as far as the decoder is concerned,
+      // so they get concealed and the jitter buffer and clock keep counting
+      for (uint32_t i = 0; i < item.dropped; i++) {
+        vita_renderer_decode(NULL, 0, item.arrival);
+      }
+      // empty items stand for lost packets
+      vita_renderer_decode(item.length > 0 ? item.data : NULL, item.length, item.arrival);
+    }
+  }
+  return 0;
+}
+
+static int vita_output_thread_main(SceSize args, void *argp) {
+  output_stats.start = sceKernelGetProcessTimeWide();
+  while (active_output_thread) {
+    uint64_t start = sceKernelGetProcessTimeWide();
+    if (!jitter_read(&jitter, buffer, grain)) {
+      media_clock_audio_idle(&session_clock);
+      // nothing to play yet, wait for more to be decoded
+      SceUInt timeout = 5000;
+      sceKernelWaitSema(output_sema, 1, &timeout);
+      continue;
+    }
+
+    if (active_audio_thread) {
+      int rest = sceAudioOutGetRestSample(port);
+      if (rest < 0)
+        rest = 0;
+      // the block is buffered in front of the port along with what is left
+      media_clock_audio_output(&session_clock, grain, jitter_depth(&jitter) + grain, rest,
+                               sceKernelGetProcessTimeWide());
+      jitter_set_drift(&jitter, media_clock_drift(&session_clock));
+
+      uint32_t latency = (uint64_t) (rest + grain) * 1000000 / 48000;
+      output_stats.blocks++;
+      output_stats.latency_total += latency;
+      if (latency > output_stats.latency_max)
+        output_stats.latency_max = latency;
+      output_stats.busy += sceKernelGetProcessTimeWide() - start;
+
+      sceAudioOutOutput(port, buffer);
+    } else {
+      media_clock_audio_idle(&session_clock);
+      // nothing is heard while the stream is paused, keep draining in real time
+      sceKernelDelayThread(grain * 1000000 / 48000);
+    }
+  }
+  return 0;
+}
+
 static void vita_renderer_cleanup() {
-  if (decoder != NULL) {
-    opus_multistream_decoder_destroy(decoder);
-    decoder = NULL;
+  if (queued_decode) {
+    active_decode_thread = false;
+    // wait 10sec
+    SceUInt timeout = 10000000;
+    int ret;
+    sceKernelWaitThreadEnd(decode_thread, &ret, &timeout);
+    sceKernelDeleteThread(decode_thread);
+    decode_thread = -1;
+
+    vita_debug_log("audio queue: %u queued, depth avg %u.%02u max %d, dropped %u full %u stale\n",
+                   decode_queue.pushed, media_queue_average_depth(&decode_queue) / 100,
+                   media_queue_average_depth(&decode_queue) % 100, decode_queue.max_depth,
+                   decode_queue.dropped_full, decode_queue.dropped_age);
+    media_queue_destroy(&decode_queue);
+    queued_decode = false;
+  }
+
+  if (output_thread >= 0) {
+    active_output_thread = false;
+    // wait 10sec
+    SceUInt timeout = 10000000;
+    int ret;
+    sceKernelWaitThreadEnd(output_thread, &ret, &timeout);
+    sceKernelDeleteThread(output_thread);
+    output_thread = -1;
+
+    uint64_t elapsed = sceKernelGetProcessTimeWide() - output_stats.start;
+    if (output_stats.blocks > 0 && elapsed > 0) {
+      vita_debug_log("audio output: %d sample blocks, %u played, latency avg %" PRIu64 " max %u us, busy %" PRIu64
+                   " us per block (%" PRIu64 ".%02" PRIu64 "%%)\n",
+                     grain, output_stats.blocks, output_stats.latency_total / output_stats.blocks,
+                     output_stats.latency_max, output_stats.busy / output_stats.blocks,
+                     output_stats.busy * 100 / elapsed, output_stats.busy * 10000 / elapsed % 100);
+    }
+  }
+  if (output_sema >= 0) {
+    sceKernelDeleteSema(output_sema);
+    output_sema = -1;
+  }
+
+  if (jitter.ring.samples != NULL) {
+    vita_debug_log("audio jitter: %u packets, jitter %u us, target %u ms, %u underruns, %u overruns, %" PRIu64 " stretched, %" PRIu64 " compressed\n",
+                   jitter.packets, jitter.jitter, jitter.target / 48, jitter.underruns, jitter.overruns,
+                   jitter.stretched, jitter.compressed);
+    vita_debug_log("audio clock: drift %d ppm, resampling by %d ppm, A/V offset %d us\n",
+                   media_clock_drift(&session_clock), jitter.ratio, media_clock_av_offset(&session_clock));
+    jitter_destroy(&jitter);
+  }
+
+  if (decoder.opus != NULL) {
+    vita_debug_log("audio loss: %u frames concealed, %u from FEC, %u decode errors (last %d), %u not %d samples\n",
+                   decoder.concealed, decoder.fec, decoder.errors, decoder.last_error, decoder.odd_sized,
+                   AUDIO_DECODER_PACKET_FRAMES);
+    if (decoder.downmix_frames > 0) {
+      vita_debug_log("audio downmix: %" PRIu64 " frames, %" PRIu64 " ns per %d samples\n", decoder.downmix_frames,
+                     decoder.downmix_time * 1000 * AUDIO_DECODER_PACKET_FRAMES / decoder.downmix_frames,
+                     AUDIO_DECODER_PACKET_FRAMES);
+    }
+    audio_decoder_destroy(&decoder);
   }
 }
 
-static int vita_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* audioContext, int arFlags) {
-  int rc;
-  decoder = opus_multistream_decoder_create(opusConfig->sampleRate,
-                                            opusConfig->channelCount,
-                                            opusConfig->streams,
-                                            opusConfig->coupledStreams,
-                                            opusConfig->mapping,
-                                            &rc);
+static uint64_t vita_renderer_clock() {
+  return sceKernelGetProcessTimeWide();
+}
 
+static void vita_renderer_play(void* context, const short* pcm, int frames, bool lost) {
+  if (lost) {
+    jitter_lost(&jitter, frames);
+    media_clock_audio_lost(&session_clock, frames);
+  } else {
+    jitter_arrival(&jitter, frames, packet_arrival);
+    media_clock_audio_arrival(&session_clock, frames, packet_arrival);
+  }
+  jitter_write(&jitter, pcm, frames);
+  sceKernelSignalSema(output_sema, 1);
+}
+
+static int vita_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* audioContext, int arFlags) {
+  int rc = audio_decoder_init(&decoder, opusConfig, vita_renderer_play, vita_renderer_clock, NULL);
   if (rc < 0) {
+      vita_debug_log("audio decoder for %d channels: %d\n", opusConfig->channelCount, rc);
       return VITA_AUDIO_ERROR_BAD_OPUS;
   }
 
-  port = sceAudioOutOpenPort(SCE_AUDIO_OUT_PORT_TYPE_MAIN, VITA_SAMPLES, 48000, SCE_AUDIO_OUT_PARAM_FORMAT_S16_STEREO);
+  if (jitter_init(&jitter, opusConfig->sampleRate, JITTER_CAPACITY, JITTER_MIN_TARGET, JITTER_MAX_TARGET) < 0) {
+      vita_renderer_cleanup();
+      return VITA_AUDIO_ERROR_BAD_OPUS;
+  }
+  media_clock_init(&session_clock, opusConfig->sampleRate);
+
+  grain = config.audio_grain;
+  if (grain != VITA_SAMPLES_MIN && grain != 2 * VITA_SAMPLES_MIN && grain != VITA_SAMPLES_MAX) {
+    vita_debug_log("audio_grain %d not supported, using %d\n", grain, VITA_SAMPLES_MAX);
+    grain = VITA_SAMPLES_MAX;
+  }
+  memset(&output_stats, 0, sizeof(output_stats));
+
+  port = sceAudioOutOpenPort(SCE_AUDIO_OUT_PORT_TYPE_MAIN, grain, 48000, SCE_AUDIO_OUT_PARAM_FORMAT_S16_STEREO);
 
   if (port < 0) {
       vita_renderer_cleanup();
@@ -69,28 +258,62 @@ static int vita_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGUR
   }
 
   vita_debug_log("open port 0x%x\n", port);
+
+  output_sema = sceKernelCreateSema("audio_output_sema", 0, 0, 1, NULL);
+  if (output_sema < 0) {
+    vita_debug_log("sceKernelCreateSema 0x%x\n", output_sema);
+    vita_renderer_cleanup();
+    return VITA_AUDIO_ERROR_THREAD;
+  }
+
+  rc = sceKernelCreateThread("audio_output", vita_output_thread_main, OUTPUT_THREAD_PRIORITY, 0x10000, 0, 0, NULL);
+  if (rc < 0) {
+    vita_debug_log("sceKernelCreateThread 0x%x\n", rc);
+    vita_renderer_cleanup();
+    return VITA_AUDIO_ERROR_THREAD;
+  }
+  output_thread = rc;
+  active_output_thread = true;
+  sceKernelStartThread(output_thread, 0, NULL);
+
+  if (config.enable_decode_queue) {
+    if (media_queue_init(&decode_queue, "audio_queue", AUDIO_QUEUE_SIZE, AUDIO_PACKET_SIZE,
+                         config.decode_queue_age * 1000, NULL, vita_renderer_clock) < 0) {
+      vita_renderer_cleanup();
+      return VITA_AUDIO_ERROR_THREAD;
+    }
+
+    rc = sceKernelCreateThread("audio_decode", vita_decode_thread_main, 0, 0x10000, 0, 0, NULL);
+    if (rc < 0) {
+      vita_debug_log("sceKernelCreateThread 0x%x\n", rc);
+      media_queue_destroy(&decode_queue);
+      vita_renderer_cleanup();
+      return VITA_AUDIO_ERROR_THREAD;
+    }
+    decode_thread = rc;
+    queued_decode = true;
+    active_decode_thread = true;
+    sceKernelStartThread(decode_thread, 0, NULL);
+  }
   return VITA_AUDIO_INIT_OK;
 }
 
+static void vita_renderer_decode(char* data, int length, uint64_t arrival) {
+  packet_arrival = arrival;
+  audio_decoder_packet(&decoder, data, length);
+}
+
 static void vita_renderer_decode_and_play_sample(char* data, int length) {
-  if (!data)
+  if (queued_decode) {
+    media_item item = {
+      .data = data,
+      .length = data != NULL ? length : 0,
+      .arrival = sceKernelGetProcessTimeWide(),
+    };
+    media_queue_push(&decode_queue, &item);
     return;
-
-  int decodeLen = opus_multistream_decode(decoder, data, length, buffer + 2 * decode_offset, FRAME_SIZE, 0);
-  if (decodeLen > 0) {
-    if (decodeLen != FRAME_SIZE)
-      return;
-    decode_offset += decodeLen;
-
-    if (decode_offset == VITA_SAMPLES) {
-      decode_offset = 0;
-      if (active_audio_thread) {
-        sceAudioOutOutput(port, buffer);
-      }
-    }
-  } else {
-    vita_debug_log("Opus error from decode: %d\n", decodeLen);
   }
+  vita_renderer_decode(data, length, sceKernelGetProcessTimeWide());
 }
 
 AUDIO_RENDERER_CALLBACKS audio_callbacks_vita = {
@@ -101,6 +324,21 @@ AUDIO_RENDERER_CALLBACKS audio_callbacks_vita = {
 };
 
 
+int vitaaudio_queued_samples() {
+  if (decoder.opus == NULL)
+    return 0;
+
+  int rest = sceAudioOutGetRestSample(port);
+  int queued = queued_decode ? media_queue_depth(&decode_queue) * AUDIO_DECODER_PACKET_FRAMES : 0;
+  return (rest > 0 ? rest : 0) + jitter_depth(&jitter) + queued;
+}
+
+void vitaaudio_jitter_stats(int* target, uint32_t* underruns, uint32_t* overruns) {
+  *target = jitter.target;
+  *underruns = jitter.underruns;
+  *overruns = jitter.overruns;
+}
+
 void vitaaudio_start() {
   active_audio_thread = true;
 }
@@ -1,4 +1,7 @@
-
+#include <stdint.h>
 
 void vitaaudio_start();
 void vitaaudio_stop();
+int vitaaudio_queued_samples();
+// jitter buffer target in samples and its underrun and overrun counts
+void vitaaudio_jitter_stats(int* target, uint32_t* underruns, uint32_t* overruns);
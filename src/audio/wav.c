@@ -0,0 +1,120 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../audio.h"
+#include "decoder.h"
+
+#include <Limelight.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// Writes the decoded audio to a 16 bit stereo WAV file, exactly what the
+// Vita renderer would queue for playback: concealed packets and the 5.1
+// downmix included, before the jitter buffer.
+
+#define WAV_HEADER_SIZE 44
+#define WAV_CHANNELS 2
+
+static FILE* fd = NULL;
+static const char* fileName = "ux0:data/moonlight/stream.wav";
+static audio_decoder decoder;
+static uint32_t sample_rate;
+static uint64_t frames;
+
+static void wav_put(unsigned char* out, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    out[i] = value >> (i * 8);
+}
+
+// sizes are filled in on cleanup, once they are known
+static void wav_write_header(uint32_t data_size) {
+  unsigned char header[WAV_HEADER_SIZE] = "RIFF____WAVEfmt ";
+  wav_put(header + 4, WAV_HEADER_SIZE - 8 + data_size, 4);
+  wav_put(header + 16, 16, 4);
+  wav_put(header + 20, 1, 2); // PCM
+  wav_put(header + 22, WAV_CHANNELS, 2);
+  wav_put(header + 24, sample_rate, 4);
+  wav_put(header + 28, sample_rate * WAV_CHANNELS * sizeof(short), 4);
+  wav_put(header + 32, WAV_CHANNELS * sizeof(short), 2);
+  wav_put(header + 34, 16, 2);
+  memcpy(header + 36, "data", 4);
+  wav_put(header + 40, data_size, 4);
+
+  fseek(fd, 0, SEEK_SET);
+  fwrite(header, sizeof(header), 1, fd);
+}
+
+static void wav_play(void* context, const short* pcm, int count, bool lost) {
+  (void) context;
+  (void) lost;
+  // samples are written in host order, which is little endian on everything
+  // this runs on
+  fwrite(pcm, sizeof(short) * WAV_CHANNELS, count, fd);
+  frames += count;
+}
+
+static void wav_cleanup() {
+  if (fd != NULL) {
+    wav_write_header(frames * WAV_CHANNELS * sizeof(short));
+    fclose(fd);
+    fd = NULL;
+    printf("wav audio: %u packets, %" PRIu64 " frames, %u concealed, %u from FEC, %u errors\n",
+           decoder.packets, frames, decoder.concealed, decoder.fec, decoder.errors);
+  }
+  audio_decoder_destroy(&decoder);
+}
+
+static int wav_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
+  (void) audioConfiguration;
+  (void) arFlags;
+  const char* path = context != NULL ? context : fileName;
+  frames = 0;
+  sample_rate = opusConfig->sampleRate;
+
+  int rc = audio_decoder_init(&decoder, opusConfig, wav_play, NULL, NULL);
+  if (rc < 0) {
+    printf("wav audio: can't decode %d channels: %d\n", opusConfig->channelCount, rc);
+    return -1;
+  }
+
+  fd = fopen(path, "wb");
+  if (fd == NULL) {
+    printf("wav audio: can't open %s\n", path);
+    wav_cleanup();
+    return -1;
+  }
+  wav_write_header(0);
+
+  printf("wav audio %d channels at %d Hz to %s\n", opusConfig->channelCount, sample_rate, path);
+  return 0;
+}
+
+static void wav_decode_and_play_sample(char* data, int length) {
+  audio_decoder_packet(&decoder, data, length);
+}
+
+AUDIO_RENDERER_CALLBACKS audio_callbacks_wav = {
+  .init = wav_init,
+  .cleanup = wav_cleanup,
+  .decodeAndPlaySample = wav_decode_and_play_sample,
+  .capabilities = CAPABILITY_DIRECT_SUBMIT,
+};
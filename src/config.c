@@ -92,12 +92,22 @@ static int ini_handle(void *out, const char *section, const char *name,
       config->stream.fps = INT(value);
     } else if (strcmp(name, "bitrate") == 0) {
       config->stream.bitrate = INT(value);
+    } else if (strcmp(name, "surround") == 0) {
+      config->stream.audioConfiguration = BOOL(value) ? AUDIO_CONFIGURATION_51_SURROUND : AUDIO_CONFIGURATION_STEREO;
     } else if (strcmp(name, "sops") == 0) {
       config->sops = BOOL(value);
     } else if (strcmp(name, "localaudio") == 0) {
       config->localaudio = BOOL(value);
     } else if (strcmp(name, "enable_frame_pacer") == 0) {
       config->enable_frame_pacer = BOOL(value);
+    } else if (strcmp(name, "frame_pacer_latency") == 0) {
+      config->frame_pacer_latency = INT(value);
+    } else if (strcmp(name, "enable_decode_queue") == 0) {
+      config->enable_decode_queue = BOOL(value);
+    } else if (strcmp(name, "decode_queue_age") == 0) {
+      config->decode_queue_age = INT(value);
+    } else if (strcmp(name, "audio_grain") == 0) {
+      config->audio_grain = INT(value);
     } else if (strcmp(name, "center_region_only") == 0) {
       config->center_region_only = BOOL(value);
     } else if (strcmp(name, "disable_powersave") == 0) {
@@ -106,12 +116,34 @@ static int ini_handle(void *out, const char *section, const char *name,
       config->jp_layout = BOOL(value);
     } else if (strcmp(name, "show_fps") == 0) {
       config->show_fps = BOOL(value);
+    } else if (strcmp(name, "show_overlay") == 0) {
+      config->show_overlay = BOOL(value);
     } else if (strcmp(name, "save_debug_log") == 0) {
       config->save_debug_log = BOOL(value);
+    } else if (strcmp(name, "platform") == 0) {
+      config->platform = STR(value);
+    } else if (strcmp(name, "video_dump") == 0) {
+      config->video_dump = STR(value);
+    } else if (strcmp(name, "audio_dump") == 0) {
+      config->audio_dump = STR(value);
+    } else if (strcmp(name, "audio_timing") == 0) {
+      config->audio_timing = STR(value);
+    } else if (strcmp(name, "video_capture") == 0) {
+      config->video_capture = STR(value);
+    } else if (strcmp(name, "decoder_history_dir") == 0) {
+      config->decoder_history_dir = STR(value);
     } else if (strcmp(name, "mapping") == 0) {
       config->mapping = STR(value);
     } else if (strcmp(name, "mouse_acceleration") == 0) {
       config->mouse_acceleration = INT(value);
+    } else if (strcmp(name, "analog_deadzone") == 0) {
+      config->analog_deadzone = INT(value);
+    } else if (strcmp(name, "analog_curve") == 0) {
+      config->analog_curve = INT(value);
+    } else if (strcmp(name, "analog_threshold") == 0) {
+      config->analog_threshold = INT(value);
+    } else if (strcmp(name, "analog_rate") == 0) {
+      config->analog_rate = INT(value);
     } else if (strcmp(name, "enable_ref_frame_invalidation") == 0) {
       config->enable_ref_frame_invalidation = BOOL(value);
     } else if (strcmp(name, "enable_remote_stream_optimization") == 0) {
@@ -137,6 +169,19 @@ void config_save(const char* filename, PCONFIGURATION config) {
   if (config->mapping)
     write_config_string(fd, "mapping", config->mapping);
 
+  if (strcmp(config->platform, "vita") != 0)
+    write_config_string(fd, "platform", config->platform);
+  if (config->video_dump)
+    write_config_string(fd, "video_dump", config->video_dump);
+  if (config->audio_dump)
+    write_config_string(fd, "audio_dump", config->audio_dump);
+  if (config->audio_timing)
+    write_config_string(fd, "audio_timing", config->audio_timing);
+  if (config->video_capture)
+    write_config_string(fd, "video_capture", config->video_capture);
+  if (strcmp(config->decoder_history_dir, "ux0:data/moonlight") != 0)
+    write_config_string(fd, "decoder_history_dir", config->decoder_history_dir);
+
   if (config->stream.width != 1280)
     write_config_int(fd, "width", config->stream.width);
   if (config->stream.height != 720)
@@ -147,6 +192,8 @@ void config_save(const char* filename, PCONFIGURATION config) {
     write_config_int(fd, "bitrate", config->stream.bitrate);
   if (config->stream.packetSize != 1024)
     write_config_int(fd, "packetsize", config->stream.packetSize);
+  if (config->stream.audioConfiguration == AUDIO_CONFIGURATION_51_SURROUND)
+    write_config_bool(fd, "surround", true);
   if (!config->sops)
     write_config_bool(fd, "sops", config->sops);
   if (config->localaudio)
@@ -156,13 +203,22 @@ void config_save(const char* filename, PCONFIGURATION config) {
     write_config_string(fd, "app", config->app);
 
   write_config_bool(fd, "enable_frame_pacer", config->enable_frame_pacer);
+  write_config_int(fd, "frame_pacer_latency", config->frame_pacer_latency);
+  write_config_bool(fd, "enable_decode_queue", config->enable_decode_queue);
+  write_config_int(fd, "decode_queue_age", config->decode_queue_age);
+  write_config_int(fd, "audio_grain", config->audio_grain);
   write_config_bool(fd, "center_region_only", config->center_region_only);
   write_config_bool(fd, "disable_powersave", config->disable_powersave);
   write_config_bool(fd, "jp_layout", config->jp_layout);
   write_config_bool(fd, "show_fps", config->show_fps);
+  write_config_bool(fd, "show_overlay", config->show_overlay);
   write_config_bool(fd, "save_debug_log", config->save_debug_log);
 
   write_config_int(fd, "mouse_acceleration", config->mouse_acceleration);
+  write_config_int(fd, "analog_deadzone", config->analog_deadzone);
+  write_config_int(fd, "analog_curve", config->analog_curve);
+  write_config_int(fd, "analog_threshold", config->analog_threshold);
+  write_config_int(fd, "analog_rate", config->analog_rate);
   write_config_bool(fd, "enable_ref_frame_invalidation", config->enable_ref_frame_invalidation);
   write_config_int(fd, "enable_remote_stream_optimization", config->stream.streamingRemotely);
 
@@ -207,6 +263,11 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   config->stream.supportsHevc = false;
 
   config->platform = "vita";
+  config->video_dump = NULL;
+  config->audio_dump = NULL;
+  config->audio_timing = NULL;
+  config->video_capture = NULL;
+  config->decoder_history_dir = "ux0:data/moonlight";
   config->model = sceKernelGetModelForCDialog();
   config->app = "Steam";
   config->action = NULL;
@@ -220,7 +281,12 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   config->disable_powersave = true;
   config->jp_layout = false;
   config->show_fps = false;
+  config->show_overlay = false;
   config->enable_frame_pacer = true;
+  config->frame_pacer_latency = 20;
+  config->enable_decode_queue = false;
+  config->decode_queue_age = 100;
+  config->audio_grain = 960;
   config->center_region_only = false;
 
   config->special_keys.nw = INPUT_SPECIAL_KEY_PAUSE | INPUT_TYPE_SPECIAL;
@@ -229,6 +295,10 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   config->special_keys.size = 150;
 
   config->mouse_acceleration = 150;
+  config->analog_deadzone = 5;
+  config->analog_curve = 100;
+  config->analog_threshold = 2;
+  config->analog_rate = 60;
   config->enable_ref_frame_invalidation = false;
 
   config->inputsCount = 0;
@@ -241,6 +311,12 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
     config_file_parse(config_file, config);
   }
 
+  // 0 would drop every queued frame and leave the pacer no time to present
+  if (config->decode_queue_age <= 0)
+    config->decode_queue_age = 100;
+  if (config->frame_pacer_latency <= 0)
+    config->frame_pacer_latency = 20;
+
   update_layout();
 
   if (config->config_file != NULL)
@@ -49,6 +49,11 @@ typedef struct _CONFIGURATION {
   char* address;
   char* mapping;
   char* platform;
+  char* video_dump;
+  char* audio_dump;
+  char* audio_timing;
+  char* video_capture;
+  char* decoder_history_dir;
   uint32_t model;
   char* config_file;
   char key_dir[4096];
@@ -62,12 +67,21 @@ typedef struct _CONFIGURATION {
   bool disable_powersave;
   bool jp_layout;
   bool show_fps;
+  bool show_overlay;
   bool enable_frame_pacer;
+  int frame_pacer_latency;
+  bool enable_decode_queue;
+  int audio_grain;
+  int decode_queue_age;
   bool center_region_only;
   bool save_debug_log;
   struct input_config inputs[MAX_INPUTS];
   int inputsCount;
   int mouse_acceleration;
+  int analog_deadzone;
+  int analog_curve;
+  int analog_threshold;
+  int analog_rate;
   bool enable_ref_frame_invalidation;
   FILE *log_file;
   // runtime configuration, value will be recreated at launch
@@ -34,6 +34,10 @@ static int connection_status = LI_DISCONNECTED;
 int connection_failed_stage = 0;
 long connection_failed_stage_code = 0;
 
+static const char* abort_reason = NULL;
+
+media_clock session_clock;
+
 void pause_output() {
   vitainput_stop();
   vitavideo_stop();
@@ -86,6 +90,7 @@ int connection_reset() {
     return -1;
   }
   connection_status = LI_READY;
+  __atomic_store_n(&abort_reason, NULL, __ATOMIC_RELEASE);
   return 0;
 }
 
@@ -142,6 +147,17 @@ void connection_stage_failed(int stage, int code) {
   vita_debug_log("connection_stage_failed - stage: %d, %d\n", stage, code);
 }
 
+void connection_abort(const char* reason) {
+  vita_debug_log("connection aborted: %s\n", reason);
+  const char* expected = NULL;
+  __atomic_compare_exchange_n(&abort_reason, &expected, reason, false,
+                              __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+const char* connection_abort_reason() {
+  return __atomic_load_n(&abort_reason, __ATOMIC_ACQUIRE);
+}
+
 bool connection_is_ready() {
   return connection_status != LI_DISCONNECTED;
 }
@@ -20,6 +20,8 @@
 #include <stdbool.h>
 #include <Limelight.h>
 
+#include "media_clock.h"
+
 //.DISCONNECTED <-.
 //      |         |
 //      v         |
@@ -45,6 +47,8 @@ enum {
 extern CONNECTION_LISTENER_CALLBACKS connection_callbacks;
 extern int connection_failed_stage;
 extern long connection_failed_stage_code;
+// reset by the audio renderer when a session starts
+extern media_clock session_clock;
 
 int connection_reset();
 int connection_paired();
@@ -52,6 +56,13 @@ int connection_minimize();
 int connection_resume();
 int connection_terminate();
 
+// The session can't go on. Called from the stream threads, where stopping
+// the connection would wait for the calling thread itself, so this only
+// records the reason; the UI terminates the connection and shows it.
+void connection_abort(const char* reason);
+// reason passed to the first connection_abort of this session, or NULL
+const char* connection_abort_reason();
+
 bool connection_is_ready();
 bool connection_is_connected();
 int connection_get_status();
@@ -144,9 +144,13 @@ int global_loop(int cursor, void *ctx, const input_data *input) {
       sceKernelDelayThread(500 * 1000);
       connection_resume();
 
-      while (connection_is_connected()) {
+      while (connection_is_connected() && connection_abort_reason() == NULL) {
         sceKernelDelayThread(500 * 1000);
       }
+      if (connection_abort_reason() != NULL) {
+        connection_terminate();
+        display_error("Stream stopped: %s", connection_abort_reason());
+      }
     }
   }
 }
@@ -15,6 +15,7 @@
 #include "client.h"
 #include "discover.h"
 #include "../platform.h"
+#include "../video/capture.h"
 
 #include "../power/vita.h"
 #include "../input/vita.h"
@@ -80,7 +81,7 @@ void ui_connect_stream(int appId) {
     return;
   }
 
-  enum platform system = VITA;
+  enum platform system = platform_check(config.platform);
   int drFlags = 0;
 
   if (config.fullscreen)
@@ -92,10 +93,19 @@ void ui_connect_stream(int appId) {
   } else {
     video_callback->capabilities &= ~CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC;
   }
+  if (config.video_capture) {
+    video_callback = capture_wrap(video_callback, config.video_capture);
+  }
+
+  char* audio_path = NULL;
+  if (system == DUMP)
+    audio_path = config.audio_dump;
+  else if (system == TIMING)
+    audio_path = config.audio_timing;
 
   ret = LiStartConnection(&server.serverInfo, &config.stream, &connection_callbacks,
                           video_callback, platform_get_audio(system),
-                          NULL, drFlags, NULL, 0);
+                          system == DUMP ? config.video_dump : NULL, drFlags, audio_path, 0);
 
   if (ret == 0) {
     server.currentGame = appId;
@@ -231,10 +241,15 @@ int ui_connect_loop(int id, void *context, const input_data *input) {
       }
 
 mainloop:
-      while (connection_is_connected()) {
+      while (connection_is_connected() && connection_abort_reason() == NULL) {
         sceKernelDelayThread(500 * 1000);
       }
 
+      if (connection_abort_reason() != NULL) {
+        display_error("Stream stopped: %s", connection_abort_reason());
+        goto disconnect;
+      }
+
       int status = connection_get_status();
 
       if (status == LI_DISCONNECTED) {
@@ -26,6 +26,7 @@ static unsigned int settings_special_codes[] = {0,
   INPUT_TYPE_DEF_NAME | INPUT_TYPE_SPECIAL,
   INPUT_SPECIAL_KEY_PAUSE | INPUT_TYPE_SPECIAL,
   INPUT_SPECIAL_KEY_KB | INPUT_TYPE_SPECIAL,
+  INPUT_SPECIAL_KEY_HISTORY | INPUT_TYPE_SPECIAL,
   // gamepad
   INPUT_TYPE_DEF_NAME | INPUT_TYPE_GAMEPAD,
   SPECIAL_FLAG | INPUT_TYPE_GAMEPAD,
@@ -53,6 +54,7 @@ static char *settings_special_names[] = {"None",
   "Special inputs",
   "Pause stream",
   "On-screen Keyboard",
+  "Save decoder history",
   // gamepad
   "Gamepad buttons",
   "Special (XBox button)",
@@ -392,6 +394,10 @@ enum {
   SETTINGS_BACK_DEADZONE,
   SETTINGS_SPECIAL_KEYS,
   SETTINGS_MOUSE_ACCEL,
+  SETTINGS_SHOW_OVERLAY,
+  SETTINGS_AUDIO_GRAIN,
+  SETTINGS_ANALOG_DEADZONE,
+  SETTINGS_ANALOG_CURVE,
 };
 
 enum {
@@ -412,9 +418,14 @@ enum {
   SETTINGS_VIEW_BACK_DEADZONE,
   SETTINGS_VIEW_SPECIAL_KEYS,
   SETTINGS_VIEW_MOUSE_ACCEL,
+  SETTINGS_VIEW_SHOW_OVERLAY,
+  SETTINGS_VIEW_AUDIO_GRAIN,
+  SETTINGS_VIEW_ANALOG_DEADZONE,
+  SETTINGS_VIEW_ANALOG_CURVE,
+  SETTINGS_VIEW_COUNT,
 };
 
-static int SETTINGS_VIEW_IDX[10];
+static int SETTINGS_VIEW_IDX[SETTINGS_VIEW_COUNT];
 
 // _countof only works for variable allocated on the stack, not from malloc (sizeof(i) will be incorrect).
 #define _countof(i) (sizeof(i) / sizeof((i)[0]))
@@ -546,6 +557,13 @@ static int settings_loop(int id, void *context, const input_data *input) {
       did_change = 1;
       config.show_fps = !config.show_fps;
       break;
+    case SETTINGS_SHOW_OVERLAY:
+      if ((input->buttons & config.btn_confirm) == 0 || input->buttons & SCE_CTRL_HOLD) {
+        break;
+      }
+      did_change = 1;
+      config.show_overlay = !config.show_overlay;
+      break;
     case SETTINGS_LOCAL_AUDIO:
       if ((input->buttons & config.btn_confirm) == 0 || input->buttons & SCE_CTRL_HOLD) {
         break;
@@ -553,6 +571,44 @@ static int settings_loop(int id, void *context, const input_data *input) {
       did_change = 1;
       config.localaudio = !config.localaudio;
       break;
+    case SETTINGS_AUDIO_GRAIN:
+      if (!left && !right) {
+          break;
+      }
+      char *grains[] = {"5 ms", "10 ms", "20 ms"};
+      sprintf(current, "%d ms", config.audio_grain / 48);
+      new_idx = _move_idx_in_array(grains, current, left ? -1 : +1);
+
+      switch (new_idx) {
+        case 0: config.audio_grain = 240; break;
+        case 1: config.audio_grain = 480; break;
+        case 2: config.audio_grain = 960; break;
+      }
+
+      did_change = 1;
+      break;
+    case SETTINGS_ANALOG_DEADZONE:
+      if (!left && !right) {
+          break;
+      }
+      char *deadzones[] = {"0%", "5%", "10%", "15%", "20%", "25%"};
+      sprintf(current, "%d%%", config.analog_deadzone);
+      new_idx = _move_idx_in_array(deadzones, current, left ? -1 : +1);
+      config.analog_deadzone = new_idx * 5;
+
+      did_change = 1;
+      break;
+    case SETTINGS_ANALOG_CURVE:
+      if (!left && !right) {
+          break;
+      }
+      char *curves[] = {"1.00", "1.50", "2.00", "2.50", "3.00"};
+      sprintf(current, "%d.%02d", config.analog_curve / 100, config.analog_curve % 100);
+      new_idx = _move_idx_in_array(curves, current, left ? -1 : +1);
+      config.analog_curve = 100 + new_idx * 50;
+
+      did_change = 1;
+      break;
     case SETTINGS_ENABLE_FRAME_PACER:
       if ((input->buttons & config.btn_confirm) == 0 || input->buttons & SCE_CTRL_HOLD) {
         break;
@@ -650,12 +706,18 @@ static int settings_loop(int id, void *context, const input_data *input) {
   sprintf(current, "%s", config.show_fps ? "yes" : "no");
   MENU_REPLACE(SETTINGS_VIEW_SHOW_FPS, current);
 
+  sprintf(current, "%s", config.show_overlay ? "yes" : "no");
+  MENU_REPLACE(SETTINGS_VIEW_SHOW_OVERLAY, current);
+
   sprintf(current, "%s", config.localaudio ? "yes" : "no");
   MENU_REPLACE(SETTINGS_VIEW_LOCAL_AUDIO, current);
 
   sprintf(current, "%s", config.enable_frame_pacer ? "yes" : "no");
   MENU_REPLACE(SETTINGS_VIEW_ENABLE_FRAME_PACER, current);
 
+  sprintf(current, "%d ms", config.audio_grain / 48);
+  MENU_REPLACE(SETTINGS_VIEW_AUDIO_GRAIN, current);
+
   sprintf(current, "%s", config.center_region_only ? "yes" : "no");
   MENU_REPLACE(SETTINGS_VIEW_CENTER_REGION_ONLY, current);
 
@@ -674,6 +736,12 @@ static int settings_loop(int id, void *context, const input_data *input) {
 
   sprintf(current, "%d", config.mouse_acceleration);
   MENU_REPLACE(SETTINGS_VIEW_MOUSE_ACCEL, current);
+
+  sprintf(current, "%d%%", config.analog_deadzone);
+  MENU_REPLACE(SETTINGS_VIEW_ANALOG_DEADZONE, current);
+
+  sprintf(current, "%d.%02d", config.analog_curve / 100, config.analog_curve % 100);
+  MENU_REPLACE(SETTINGS_VIEW_ANALOG_CURVE, current);
   return 0;
 }
 
@@ -712,15 +780,19 @@ int ui_settings_menu() {
   MENU_ENTRY(SETTINGS_ENABLE_STREAM_OPTIMIZE, SETTINGS_VIEW_ENABLE_STREAM_OPTIMIZE, "Enable stream optimization", "");
   MENU_ENTRY(SETTINGS_ENABLE_FRAME_PACER, SETTINGS_VIEW_ENABLE_FRAME_PACER, "Enable frame pacer", "");
   MENU_ENTRY(SETTINGS_LOCAL_AUDIO, SETTINGS_VIEW_LOCAL_AUDIO, "Enable local audio", "");
+  MENU_ENTRY(SETTINGS_AUDIO_GRAIN, SETTINGS_VIEW_AUDIO_GRAIN, "Audio output block", ICON_LEFT_RIGHT_ARROWS);
 
   MENU_CATEGORY("System");
   MENU_ENTRY(SETTINGS_SAVE_DEBUG_LOG, SETTINGS_VIEW_SAVE_DEBUG_LOG, "Enable debug log", "");
   MENU_ENTRY(SETTINGS_DISABLE_POWERSAVE, SETTINGS_VIEW_DISABLE_POWERSAVE, "Disable power save", "");
   MENU_ENTRY(SETTINGS_JP_LAYOUT, SETTINGS_VIEW_JP_LAYOUT, "Swap X & O for Moonlight", "");
   MENU_ENTRY(SETTINGS_SHOW_FPS, SETTINGS_VIEW_SHOW_FPS, "Display streaming FPS", "");
+  MENU_ENTRY(SETTINGS_SHOW_OVERLAY, SETTINGS_VIEW_SHOW_OVERLAY, "Display performance overlay", "");
 
   MENU_CATEGORY("Input");
   MENU_ENTRY(SETTINGS_MOUSE_ACCEL, SETTINGS_VIEW_MOUSE_ACCEL, "Mouse acceleration", ICON_LEFT_RIGHT_ARROWS);
+  MENU_ENTRY(SETTINGS_ANALOG_DEADZONE, SETTINGS_VIEW_ANALOG_DEADZONE, "Analog stick deadzone", ICON_LEFT_RIGHT_ARROWS);
+  MENU_ENTRY(SETTINGS_ANALOG_CURVE, SETTINGS_VIEW_ANALOG_CURVE, "Analog stick response curve", ICON_LEFT_RIGHT_ARROWS);
   MENU_ENTRY(SETTINGS_ENABLE_MAPPING, SETTINGS_VIEW_ENABLE_MAPPING, "Enable mapping file", "");
   MENU_MESSAGE("Located at ux0:data/moonlight/mappings/vita.conf");
   MENU_MESSAGE("Example in github repo.");
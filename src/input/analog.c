@@ -0,0 +1,114 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "analog.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ANALOG_MAX 32767
+// farthest an 8 bit hardware value gets from the center along one axis,
+// this is full deflection
+#define ANALOG_RANGE 32640
+#define ANALOG_CURVE_STEP 128
+
+void analog_filter_init(analog_filter* filter, int deadzone, int curve, int threshold, int max_rate) {
+  memset(filter, 0, sizeof(analog_filter));
+
+  float dead = deadzone / 100.f;
+  float exponent = curve > 0 ? curve / 100.f : 1.f;
+  for (int i = 0; i < ANALOG_CURVE_SIZE; i++) {
+    float distance = (float) i * ANALOG_CURVE_STEP / ANALOG_RANGE;
+    if (distance > 1.f)
+      distance = 1.f;
+    if (distance <= dead || dead >= 1.f) {
+      filter->curve[i] = 0;
+      continue;
+    }
+    float scaled = (distance - dead) / (1.f - dead);
+    filter->curve[i] = lroundf(powf(scaled, exponent) * ANALOG_MAX);
+  }
+
+  for (int i = 0; i < ANALOG_AXES; i++)
+    filter->threshold[i] = i < ANALOG_STICK_AXES ? threshold * 256 : threshold;
+  filter->interval = max_rate > 0 ? 1000000 / max_rate : 0;
+}
+
+void analog_filter_stick(analog_filter* filter, short* x, short* y) {
+  int32_t dx = *x, dy = *y;
+  int32_t distance = lroundf(sqrtf((float) dx * dx + (float) dy * dy));
+  if (distance == 0)
+    return;
+
+  int32_t position = distance < ANALOG_MAX ? distance : ANALOG_MAX;
+  int32_t index = position / ANALOG_CURVE_STEP;
+  int32_t fraction = position % ANALOG_CURVE_STEP;
+  int32_t a = filter->curve[index];
+  int32_t b = index + 1 < ANALOG_CURVE_SIZE ? filter->curve[index + 1] : a;
+  int32_t magnitude = a + (b - a) * fraction / ANALOG_CURVE_STEP;
+
+  // keep the direction, corners past the circle stay past it
+  int32_t rx = dx * magnitude / position;
+  int32_t ry = dy * magnitude / position;
+  *x = rx > ANALOG_MAX ? ANALOG_MAX : rx < -ANALOG_MAX - 1 ? -ANALOG_MAX - 1 : rx;
+  *y = ry > ANALOG_MAX ? ANALOG_MAX : ry < -ANALOG_MAX - 1 ? -ANALOG_MAX - 1 : ry;
+}
+
+bool analog_filter_update(analog_filter* filter, const short axes[ANALOG_AXES], bool forced, uint64_t now) {
+  filter->updates++;
+
+  bool differs = false, significant = forced;
+  for (int i = 0; i < ANALOG_AXES; i++) {
+    if (axes[i] == filter->sent[i])
+      continue;
+    differs = true;
+    if (abs(axes[i] - filter->sent[i]) >= filter->threshold[i] || axes[i] == 0)
+      significant = true;
+  }
+
+  if (!differs && !forced) {
+    filter->pending = false;
+    filter->small_since = 0;
+    return false;
+  }
+
+  if (!significant) {
+    if (filter->small_since == 0)
+      filter->small_since = now;
+    if (now - filter->small_since < ANALOG_SETTLE) {
+      filter->below_threshold++;
+      filter->pending = true;
+      return false;
+    }
+  }
+
+  if (!forced && filter->interval > 0 && filter->last_send != 0 && now - filter->last_send < filter->interval) {
+    filter->rate_limited++;
+    filter->pending = true;
+    return false;
+  }
+
+  memcpy(filter->sent, axes, sizeof(filter->sent));
+  filter->last_send = now;
+  filter->small_since = 0;
+  filter->pending = false;
+  filter->sends++;
+  return true;
+}
@@ -0,0 +1,79 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Analog processing between reading the sticks and sending them.
+//
+// Each stick goes through a radial deadzone, so the dead center is round
+// and diagonals aren't cut, and then a response curve applied to its
+// distance from the center, looked up in a table built once from the
+// configuration. The remaining range is stretched over the whole axis, so
+// full deflection is still full scale.
+//
+// Sending is then held back for analog noise. A change of less than the
+// threshold on every axis only goes out once it held for ANALOG_SETTLE,
+// and analog changes go out at most max_rate times a second. Whatever is
+// held back is sent later: the caller keeps asking while pending is set,
+// so the last state always gets through, and the input thread counts a
+// pending state as a change, so it doesn't back off to its idle rate
+// meanwhile. Button changes (forced) go out right away, returning an axis
+// to zero doesn't wait for ANALOG_SETTLE but still for max_rate.
+//
+// Times are in microseconds and passed in by the caller.
+
+// lx ly rx ry as 16 bit axes, then the two triggers as 8 bit ones
+#define ANALOG_AXES 6
+#define ANALOG_STICK_AXES 4
+// a change below the threshold is sent after holding this long
+#define ANALOG_SETTLE 100000
+// stick distance from the center in steps of 128, interpolated
+#define ANALOG_CURVE_SIZE 257
+
+typedef struct {
+  short curve[ANALOG_CURVE_SIZE];
+  int32_t threshold[ANALOG_AXES];
+  uint32_t interval;
+
+  short sent[ANALOG_AXES];
+  uint64_t last_send;
+  uint64_t small_since;
+  bool pending;
+
+  // counters, reset by analog_filter_init
+  uint32_t updates;
+  uint32_t sends;
+  uint32_t below_threshold;
+  uint32_t rate_limited;
+} analog_filter;
+
+// deadzone is in percent of the stick's range, curve the response exponent
+// in percent (100 is linear), threshold in steps of the 8 bit hardware
+// value and max_rate in sends per second, 0 for no limit
+void analog_filter_init(analog_filter* filter, int deadzone, int curve, int threshold, int max_rate);
+
+// apply deadzone and curve to a stick
+void analog_filter_stick(analog_filter* filter, short* x, short* y);
+
+// Returns true if axes should be sent now, and takes them as sent then.
+// forced is set when something else about the state changed.
+bool analog_filter_update(analog_filter* filter, const short axes[ANALOG_AXES], bool forced, uint64_t now);
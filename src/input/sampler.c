@@ -0,0 +1,72 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sampler.h"
+
+#include <string.h>
+
+// wake up this long after a sample is due, so it is in the buffer by then
+#define INPUT_SAMPLER_GUARD 1000
+
+void input_sampler_init(input_sampler* sampler, uint32_t period) {
+  memset(sampler, 0, sizeof(input_sampler));
+  sampler->period = period;
+  sampler->frames = 1;
+}
+
+uint64_t input_sampler_next(input_sampler* sampler, uint32_t count, uint64_t sample_time, bool changed,
+                            uint64_t now) {
+  sampler->wakeups++;
+  sampler->samples += count;
+  if (count > 0 && sample_time != 0)
+    sampler->last_sample = sample_time;
+
+  if (changed || sampler->last_change == 0 || now < sampler->last_change) {
+    sampler->last_change = now;
+    sampler->frames = 1;
+  } else if (now - sampler->last_change >= INPUT_SAMPLER_IDLE) {
+    sampler->frames = INPUT_SAMPLER_IDLE_FRAMES;
+  }
+
+  uint64_t interval = (uint64_t) sampler->period * sampler->frames;
+  if (sampler->last_sample == 0 || sampler->last_sample > now)
+    return now + interval;
+
+  // frames samples after the newest one read, or if that one is already due
+  // the first one on the controller's grid that isn't
+  uint64_t next = sampler->last_sample + interval + INPUT_SAMPLER_GUARD;
+  if (next <= now)
+    next += ((now - next) / sampler->period + 1) * sampler->period;
+  return next;
+}
+
+void input_sampler_sent(input_sampler* sampler, uint64_t sample_time, uint64_t now) {
+  if (sample_time == 0 || now < sample_time)
+    return;
+
+  uint32_t latency = now - sample_time;
+  sampler->events++;
+  sampler->latency_total += latency;
+  if (latency > sampler->latency_max)
+    sampler->latency_max = latency;
+}
+
+uint32_t input_sampler_average_latency(input_sampler* sampler) {
+  return sampler->events ? sampler->latency_total / sampler->events : 0;
+}
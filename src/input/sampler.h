@@ -0,0 +1,71 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Wakeup schedule of the input thread.
+//
+// The controller is sampled once per frame and the samples are buffered,
+// so reading more often than that finds nothing new, and reading less
+// often loses nothing but delays the sample. Wakeups are therefore put just
+// after the next sample is due, lined up with the timestamp of the newest
+// sample read. While inputs change that happens every frame. Only after
+// INPUT_SAMPLER_IDLE without any change, when nobody is holding the
+// controller, the interval goes to INPUT_SAMPLER_IDLE_FRAMES frames; the
+// first wakeup that finds a change goes back to every frame. Samples are
+// buffered, so nothing is lost while backed off, the first press is only
+// sent up to that many frames late.
+//
+// It also keeps the time from a sample being taken to the event it caused
+// being sent. Times are in microseconds and passed in by the caller.
+
+// no change for this long counts as idle
+#define INPUT_SAMPLER_IDLE 10000000
+// interval while idle, in frames
+#define INPUT_SAMPLER_IDLE_FRAMES 4
+
+typedef struct {
+  uint32_t period;
+  uint32_t frames;
+  uint64_t last_sample;
+  uint64_t last_change;
+
+  // counters, reset by input_sampler_init
+  uint32_t wakeups;
+  uint32_t samples;
+  uint32_t events;
+  uint64_t latency_total;
+  uint32_t latency_max;
+} input_sampler;
+
+// period is the time between two controller samples
+void input_sampler_init(input_sampler* sampler, uint32_t period);
+
+// A wakeup read count samples, the newest one taken at sample_time; changed
+// if any input changed since the previous wakeup. Returns when to wake up next.
+uint64_t input_sampler_next(input_sampler* sampler, uint32_t count, uint64_t sample_time, bool changed,
+                            uint64_t now);
+
+// an event caused by the sample taken at sample_time was sent at now
+void input_sampler_sent(input_sampler* sampler, uint64_t sample_time, uint64_t now);
+
+uint32_t input_sampler_average_latency(input_sampler* sampler);
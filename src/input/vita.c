@@ -31,8 +31,11 @@
 #include "../graphics.h"
 #include "../config.h"
 #include "../connection.h"
+#include "../debug.h"
 #include "vita.h"
+#include "analog.h"
 #include "mapping.h"
+#include "sampler.h"
 #include "../gui/ime.h"
 #include "../video/vita.h"
 
@@ -44,6 +47,7 @@
 #include <psp2/kernel/threadmgr.h>
 
 #include <psp2/ctrl.h>
+#include <psp2/display.h>
 #include <psp2/touch.h>
 #include <psp2/rtc.h>
 
@@ -51,6 +55,11 @@
 #define HEIGHT 544
 #define IME_TEXT_MAX_BUF 256
 
+// the controller is sampled once per vblank and keeps the last 64 samples
+#define INPUT_BATCH_SIZE 64
+// wakeup interval while the stream isn't running
+#define INPUT_INACTIVE_INTERVAL 50000
+
 struct mapping map = {0};
 
 typedef struct input_data {
@@ -303,6 +312,12 @@ inline void special(uint32_t defined, uint32_t pressed, uint32_t old_pressed) {
           connection_minimize();
           return;
         }
+        else if (dev_val == INPUT_SPECIAL_KEY_HISTORY) {
+          if (!old_pressed) {
+            vitavideo_save_history();
+          }
+          return;
+        }
         else if(dev_val == INPUT_SPECIAL_KEY_KB) {
           char sendText[IME_TEXT_MAX_BUF] = {0};
           vitavideo_stop();
@@ -375,20 +390,15 @@ inline void special(uint32_t defined, uint32_t pressed, uint32_t old_pressed) {
 
 }
 
-static inline void vitainput_process(void) {
-  memset(&pad, 0, sizeof(pad));
-  memset(&touch, 0, sizeof(TouchData));
-  memset(&curr, 0, sizeof(input_data));
+static SceCtrlData samples[INPUT_BATCH_SIZE];
+static input_sampler sampler;
+static analog_filter analog;
 
-  sceCtrlSetSamplingModeExt(SCE_CTRL_MODE_ANALOG_WIDE);
-  sceCtrlPeekBufferPositiveExt2(controller_port, &pad, 1);
-
-  sceTouchPeek(SCE_TOUCH_PORT_FRONT, &front, 1);
-  sceTouchPeek(SCE_TOUCH_PORT_BACK, &back, 1);
-  read_frontscreen();
-  read_backscreen();
-
-  sceRtcGetCurrentTick(&current);
+// Build the controller state from pad and touch and send it if it changed.
+// sample_time is the time pad was sampled, 0 if it's an old sample. Returns
+// true if something was sent or analog changes are still held back.
+static bool vitainput_process_pad(uint64_t sample_time) {
+  memset(&curr, 0, sizeof(input_data));
 
   // buttons
   curr.button |= is_pressed(map.btn_dpad_up)    ? UP_FLAG     : 0;
@@ -413,6 +423,49 @@ static inline void vitainput_process(void) {
   curr.ly = read_analog(map.abs_y);
   curr.rx = read_analog(map.abs_rx);
   curr.ry = read_analog(map.abs_ry);
+  analog_filter_stick(&analog, &curr.lx, &curr.ly);
+  analog_filter_stick(&analog, &curr.rx, &curr.ry);
+
+  short axes[ANALOG_AXES] = {curr.lx, curr.ly, curr.rx, curr.ry, curr.lt, curr.rt};
+  if (!analog_filter_update(&analog, axes, curr.button != old.button, sceKernelGetSystemTimeWide())) {
+    return analog.pending;
+  }
+
+  LiSendControllerEvent(curr.button, curr.lt, curr.rt,
+                        curr.lx, -1 * curr.ly, curr.rx, -1 * curr.ry);
+  input_sampler_sent(&sampler, sample_time, sceKernelGetSystemTimeWide());
+  memcpy(&old, &curr, sizeof(input_data));
+  memcpy(&pad_old, &pad, sizeof(SceCtrlData));
+  return true;
+}
+
+// Returns true if any input changed, count is the number of samples read.
+// Every controller sample buffered since the last call is gone through in
+// order, so a press shorter than the wakeup interval still gets sent.
+static inline bool vitainput_process(uint32_t* count) {
+  bool changed = false;
+  memset(&touch, 0, sizeof(TouchData));
+
+  sceCtrlSetSamplingModeExt(SCE_CTRL_MODE_ANALOG_WIDE);
+  int read = sceCtrlReadBufferPositiveExt2(controller_port, samples, INPUT_BATCH_SIZE);
+
+  sceTouchPeek(SCE_TOUCH_PORT_FRONT, &front, 1);
+  sceTouchPeek(SCE_TOUCH_PORT_BACK, &back, 1);
+  read_frontscreen();
+  read_backscreen();
+
+  sceRtcGetCurrentTick(&current);
+
+  *count = read > 0 ? read : 0;
+  if (read > 0) {
+    for (int i = 0; i < read; i++) {
+      memcpy(&pad, &samples[i], sizeof(SceCtrlData));
+      changed |= vitainput_process_pad(pad.timeStamp);
+    }
+  } else {
+    // no new sample, touch may still have changed what is pressed
+    changed |= vitainput_process_pad(0);
+  }
 
   // special touchscreen buttons
   special(config.special_keys.nw,
@@ -483,26 +536,30 @@ static inline void vitainput_process(void) {
       break;
   }
 
-  if (memcmp(&curr, &old, sizeof(input_data)) != 0) {
-    LiSendControllerEvent(curr.button, curr.lt, curr.rt,
-                          curr.lx, -1 * curr.ly, curr.rx, -1 * curr.ry);
-    memcpy(&old, &curr, sizeof(input_data));
-    memcpy(&pad_old, &pad, sizeof(SceCtrlData));
-  }
   if (memcmp(&touch, &touch_old, sizeof(TouchData)) != 0) {
     memcpy(&touch_old, &touch, sizeof(TouchData));
+    changed = true;
   }
+  return changed;
 }
 
 static uint8_t active_input_thread = 0;
 
 int vitainput_thread(SceSize args, void *argp) {
   while (1) {
+    uint64_t next;
     if (active_input_thread) {
-      vitainput_process();
+      uint32_t count;
+      bool changed = vitainput_process(&count);
+      next = input_sampler_next(&sampler, count, pad.timeStamp, changed, sceKernelGetSystemTimeWide());
+    } else {
+      next = sceKernelGetSystemTimeWide() + INPUT_INACTIVE_INTERVAL;
     }
 
-    sceKernelDelayThread(5000); // 5 ms
+    uint64_t now = sceKernelGetSystemTimeWide();
+    if (next > now) {
+      sceKernelDelayThread(next - now);
+    }
   }
 
   return 0;
@@ -523,6 +580,9 @@ bool vitainput_init() {
 }
 
 void vitainput_config(CONFIGURATION config) {
+  analog_filter_init(&analog, config.analog_deadzone, config.analog_curve,
+                     config.analog_threshold, config.analog_rate);
+
   map.abs_x           = LEFTX               | INPUT_TYPE_ANALOG;
   map.abs_y           = LEFTY               | INPUT_TYPE_ANALOG;
   map.abs_rx          = RIGHTX              | INPUT_TYPE_ANALOG;
@@ -612,10 +672,27 @@ void vitainput_config(CONFIGURATION config) {
   mouse_multiplier = 1 + (0.01 * config.mouse_acceleration);
 }
 
+void vitainput_latency_stats(uint32_t* average, uint32_t* max) {
+  *average = input_sampler_average_latency(&sampler);
+  *max = sampler.latency_max;
+}
+
 void vitainput_start(void) {
+  float refresh_rate = 0;
+  if (sceDisplayGetRefreshRate(&refresh_rate) < 0 || refresh_rate < 1) {
+    refresh_rate = 59.94005f;
+  }
+  input_sampler_init(&sampler, 1000000 / refresh_rate);
   active_input_thread = true;
 }
 
 void vitainput_stop(void) {
   active_input_thread = false;
+  if (sampler.wakeups > 0) {
+    vita_debug_log("input: %u wakeups, %u samples, %u events, sample to send avg %u max %u us\n",
+                   sampler.wakeups, sampler.samples, sampler.events,
+                   input_sampler_average_latency(&sampler), sampler.latency_max);
+    vita_debug_log("analog: %u updates, %u sent, %u below threshold, %u rate limited\n",
+                   analog.updates, analog.sends, analog.below_threshold, analog.rate_limited);
+  }
 }
\ No newline at end of file
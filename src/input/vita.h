@@ -58,7 +58,8 @@ enum {
 
 enum {
   INPUT_SPECIAL_KEY_PAUSE,
-  INPUT_SPECIAL_KEY_KB
+  INPUT_SPECIAL_KEY_KB,
+  INPUT_SPECIAL_KEY_HISTORY
 };
 
 bool vitainput_init();
@@ -66,3 +67,5 @@ void vitainput_config(CONFIGURATION config);
 
 void vitainput_start(void);
 void vitainput_stop(void);
+// time from a controller sample to the event it caused being sent, in us
+void vitainput_latency_stats(uint32_t* average, uint32_t* max);
@@ -28,6 +28,7 @@
 #include "platform.h"
 
 #include "input/vita.h"
+#include "video/vita.h"
 
 #include <Limelight.h>
 
@@ -125,6 +126,11 @@ int main(int argc, char* argv[]) {
 
   config.log_file = fopen("ux0:data/moonlight/moonlight.log", "w");
 
+  // open the decoder for the configured mode now, the first connect reuses it
+  if (platform_check(config.platform) == VITA) {
+    vitavideo_warmup(config.stream.width, config.stream.height);
+  }
+
   load_all_known_devices();
 
   gui_loop();
@@ -0,0 +1,114 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "media_clock.h"
+
+#include <string.h>
+
+// longer gaps between packets are a paused stream, the host rate is
+// measured anew after one
+#define MEDIA_CLOCK_PAUSE 500000
+// delays follow 1/16 of every new sample
+#define MEDIA_CLOCK_SMOOTHING 16
+// a rate that wasn't measured yet
+#define MEDIA_CLOCK_UNKNOWN INT32_MIN
+
+void media_clock_init(media_clock* clock, uint32_t sample_rate) {
+  memset(clock, 0, sizeof(media_clock));
+  clock->sample_rate = sample_rate;
+  clock->host_drift = MEDIA_CLOCK_UNKNOWN;
+  clock->output_drift = MEDIA_CLOCK_UNKNOWN;
+}
+
+// drift of frames played or produced over elapsed local time, in ppm
+static int32_t media_clock_rate(media_clock* clock, uint64_t frames, uint64_t elapsed) {
+  int64_t media_time = frames * 1000000 / clock->sample_rate;
+  return (media_time - (int64_t) elapsed) * 1000000 / (int64_t) elapsed;
+}
+
+void media_clock_audio_arrival(media_clock* clock, uint32_t frames, uint64_t now) {
+  if (clock->host_start == 0 || now < clock->host_last || now - clock->host_last > MEDIA_CLOCK_PAUSE) {
+    // the frames of the first packet were produced before the window started
+    clock->host_start = now;
+    clock->host_frames = 0;
+  } else {
+    clock->host_frames += frames;
+    uint64_t elapsed = now - clock->host_start;
+    if (elapsed >= MEDIA_CLOCK_SETTLE)
+      __atomic_store_n(&clock->host_drift, media_clock_rate(clock, clock->host_frames, elapsed), __ATOMIC_RELAXED);
+  }
+  clock->host_last = now;
+}
+
+void media_clock_audio_lost(media_clock* clock, uint32_t frames) {
+  if (clock->host_start != 0)
+    clock->host_frames += frames;
+}
+
+static void media_clock_smooth(uint32_t* value, uint32_t sample) {
+  uint32_t current = __atomic_load_n(value, __ATOMIC_RELAXED);
+  if (current != 0)
+    sample = current + ((int32_t) sample - (int32_t) current) / MEDIA_CLOCK_SMOOTHING;
+  __atomic_store_n(value, sample, __ATOMIC_RELAXED);
+}
+
+void media_clock_audio_output(media_clock* clock, uint32_t frames, uint32_t buffered, uint32_t rest,
+                              uint64_t now) {
+  if (clock->output_start == 0) {
+    clock->output_start = now;
+    clock->output_frames = 0;
+    clock->output_rest = rest;
+  } else if (now > clock->output_start) {
+    // the port plays at its own pace, what it holds hasn't been played yet;
+    // it can't hold more than it was given, if it says so the count is off
+    int64_t played = (int64_t) clock->output_frames + clock->output_rest - rest;
+    uint64_t elapsed = now - clock->output_start;
+    if (elapsed >= MEDIA_CLOCK_SETTLE && played > 0)
+      __atomic_store_n(&clock->output_drift, media_clock_rate(clock, played, elapsed), __ATOMIC_RELAXED);
+  }
+  clock->output_frames += frames;
+
+  // audio arriving now is played after everything in front of it
+  media_clock_smooth(&clock->audio_delay, (uint64_t) (buffered + rest) * 1000000 / clock->sample_rate);
+}
+
+void media_clock_audio_idle(media_clock* clock) {
+  clock->output_start = 0;
+}
+
+void media_clock_video_presented(media_clock* clock, uint64_t received, uint64_t now) {
+  if (received != 0 && now > received)
+    media_clock_smooth(&clock->video_delay, now - received);
+}
+
+int32_t media_clock_drift(media_clock* clock) {
+  int32_t host = __atomic_load_n(&clock->host_drift, __ATOMIC_RELAXED);
+  int32_t output = __atomic_load_n(&clock->output_drift, __ATOMIC_RELAXED);
+  if (host == MEDIA_CLOCK_UNKNOWN || output == MEDIA_CLOCK_UNKNOWN)
+    return 0;
+  return host - output;
+}
+
+int32_t media_clock_av_offset(media_clock* clock) {
+  uint32_t audio = __atomic_load_n(&clock->audio_delay, __ATOMIC_RELAXED);
+  uint32_t video = __atomic_load_n(&clock->video_delay, __ATOMIC_RELAXED);
+  if (audio == 0 || video == 0)
+    return 0;
+  return (int32_t) video - (int32_t) audio;
+}
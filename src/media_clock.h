@@ -0,0 +1,88 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Clock of a streaming session.
+//
+// The host produces audio at its nominal sample rate by its own clock, and
+// the audio port plays it back by the Vita's. Neither is exact, so over a
+// long session one runs ahead of the other and the audio buffered in
+// between slowly grows or shrinks. Both rates are measured here against
+// local time: the audio frames that arrived (lost ones included) and the
+// frames handed to the port, each counted from the start of a window. Their
+// difference is the drift the audio path has to resample away.
+//
+// It also keeps the time audio and video spend between arriving and being
+// heard or seen. Their difference is the A/V offset, positive when the
+// picture comes out later than the sound that goes with it.
+//
+// Every field has a single writer; the audio receive side, the audio output
+// and the video render thread can each run on their own thread. Times are
+// in microseconds and passed in by the caller.
+
+// drift isn't reported before a window is this long
+#define MEDIA_CLOCK_SETTLE 10000000
+
+typedef struct {
+  uint32_t sample_rate;
+
+  // audio receive side
+  uint64_t host_start;
+  uint64_t host_last;
+  uint64_t host_frames;
+
+  // audio output side
+  uint64_t output_start;
+  uint64_t output_frames;
+  uint32_t output_rest;
+
+  // published for any thread, in ppm against local time
+  int32_t host_drift;
+  int32_t output_drift;
+
+  // smoothed delay from arrival to being heard or seen
+  uint32_t audio_delay;
+  uint32_t video_delay;
+} media_clock;
+
+void media_clock_init(media_clock* clock, uint32_t sample_rate);
+
+// audio receive side: a packet of frames arrived at now, or was lost
+void media_clock_audio_arrival(media_clock* clock, uint32_t frames, uint64_t now);
+void media_clock_audio_lost(media_clock* clock, uint32_t frames);
+
+// audio output side: a block of frames is about to be handed to the port at
+// now, with buffered frames still waiting in front of the port and rest
+// frames in it
+void media_clock_audio_output(media_clock* clock, uint32_t frames, uint32_t buffered, uint32_t rest,
+                              uint64_t now);
+// the port ran dry or playback paused, the output rate is measured anew
+void media_clock_audio_idle(media_clock* clock);
+
+// a video frame received at received was presented at now
+void media_clock_video_presented(media_clock* clock, uint64_t received, uint64_t now);
+
+// how much faster the host produces audio than the port plays it, in ppm;
+// 0 until both sides were measured for MEDIA_CLOCK_SETTLE
+int32_t media_clock_drift(media_clock* clock);
+// video delay minus audio delay, 0 until both were seen
+int32_t media_clock_av_offset(media_clock* clock);
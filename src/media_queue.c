@@ -0,0 +1,209 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "media_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_INDEX(queue, i) (((queue)->head + (i)) % MEDIA_QUEUE_MAX)
+
+int media_queue_init(media_queue* queue, const char* name, int capacity, uint32_t payload_size,
+                     uint32_t max_age, media_queue_release release, media_queue_clock clock) {
+  memset(queue, 0, sizeof(media_queue));
+  if (capacity > MEDIA_QUEUE_MAX)
+    capacity = MEDIA_QUEUE_MAX;
+  queue->capacity = capacity;
+  queue->max_age = max_age;
+  queue->release = release;
+  queue->clock = clock;
+
+  if (payload_size > 0) {
+    queue->payload = malloc(capacity * payload_size);
+    if (queue->payload == NULL)
+      return -1;
+    queue->payload_size = payload_size;
+    for (int i = 0; i < capacity; i++)
+      queue->free_slots[queue->free_count++] = i;
+  }
+
+  // every queued item has a signal, a push racing a drop can leave one more
+  if (media_sync_init(&queue->sync, name, MEDIA_QUEUE_MAX * 2) < 0) {
+    media_sync_destroy(&queue->sync);
+    if (queue->payload != NULL) {
+      free(queue->payload);
+      queue->payload = NULL;
+    }
+    return -1;
+  }
+  queue->ready = true;
+  return 0;
+}
+
+void media_queue_destroy(media_queue* queue) {
+  if (queue->ready) {
+    media_queue_flush(queue);
+    media_sync_destroy(&queue->sync);
+    queue->ready = false;
+  }
+  if (queue->payload != NULL) {
+    free(queue->payload);
+    queue->payload = NULL;
+  }
+}
+
+// remove the i-th queued item, the lock has to be held
+static void media_queue_remove(media_queue* queue, int i, bool drop) {
+  media_item* item = &queue->items[QUEUE_INDEX(queue, i)];
+  if (queue->payload != NULL)
+    queue->free_slots[queue->free_count++] = ((char*) item->data - queue->payload) / queue->payload_size;
+  else if (drop && queue->release != NULL)
+    queue->release(item);
+  if (drop) {
+    // the next item, or the next push, stands in for this one
+    uint32_t dropped = item->dropped + 1;
+    if (i < queue->count - 1)
+      queue->items[QUEUE_INDEX(queue, i + 1)].dropped += dropped;
+    else
+      queue->dropped += dropped;
+    // the item won't be popped, neither should its signal
+    media_sync_wait(&queue->sync, 0);
+  }
+
+  for (; i < queue->count - 1; i++)
+    queue->items[QUEUE_INDEX(queue, i)] = queue->items[QUEUE_INDEX(queue, i + 1)];
+  queue->count--;
+}
+
+// drop the oldest disposable item, or the oldest one if there is none
+static void media_queue_drop(media_queue* queue) {
+  for (int i = 0; i < queue->count; i++) {
+    if (queue->items[QUEUE_INDEX(queue, i)].flags & MEDIA_ITEM_DISPOSABLE) {
+      queue->dropped_disposable++;
+      media_queue_remove(queue, i, true);
+      return;
+    }
+  }
+  queue->dropped_required++;
+  media_queue_remove(queue, 0, true);
+}
+
+// Drop the items that waited longer than max_age, the lock has to be held.
+// Items are queued in the order they arrived, so those are the first ones;
+// the disposable ones among them go first.
+static void media_queue_expire(media_queue* queue, uint64_t now) {
+  int expired = 0;
+  while (expired < queue->count &&
+         now - queue->items[QUEUE_INDEX(queue, expired)].arrival > queue->max_age)
+    expired++;
+  queue->dropped_age += expired;
+
+  for (int i = 0; i < expired;) {
+    if (queue->items[QUEUE_INDEX(queue, i)].flags & MEDIA_ITEM_DISPOSABLE) {
+      queue->dropped_disposable++;
+      media_queue_remove(queue, i, true);
+      expired--;
+    } else {
+      i++;
+    }
+  }
+  for (; expired > 0; expired--) {
+    queue->dropped_required++;
+    media_queue_remove(queue, 0, true);
+  }
+}
+
+void media_queue_make_room(media_queue* queue) {
+  media_sync_lock(&queue->sync);
+  while (queue->count >= queue->capacity) {
+    media_queue_drop(queue);
+    queue->dropped_full++;
+  }
+  media_sync_unlock(&queue->sync);
+}
+
+void media_queue_push(media_queue* queue, media_item* item) {
+  media_sync_lock(&queue->sync);
+  while (queue->count >= queue->capacity) {
+    media_queue_drop(queue);
+    queue->dropped_full++;
+  }
+
+  media_item* slot = &queue->items[QUEUE_INDEX(queue, queue->count)];
+  *slot = *item;
+  slot->dropped += queue->dropped;
+  queue->dropped = 0;
+  if (queue->payload != NULL) {
+    uint32_t length = item->length < queue->payload_size ? item->length : queue->payload_size;
+    slot->data = queue->payload + queue->free_slots[--queue->free_count] * queue->payload_size;
+    slot->length = length;
+    if (length > 0)
+      memcpy(slot->data, item->data, length);
+  }
+  queue->count++;
+  queue->pushed++;
+  if (queue->count > queue->max_depth)
+    queue->max_depth = queue->count;
+  media_sync_unlock(&queue->sync);
+
+  media_sync_signal(&queue->sync);
+}
+
+bool media_queue_pop(media_queue* queue, media_item* item, void* buffer, uint32_t timeout) {
+  // an item that is already there takes its signal along, so the count
+  // doesn't build up into wakeups that find nothing
+  media_sync_wait(&queue->sync, media_queue_depth(queue) == 0 ? timeout : 0);
+
+  bool found = false;
+  media_sync_lock(&queue->sync);
+  media_queue_expire(queue, queue->clock());
+
+  if (queue->count > 0) {
+    queue->depth_total += queue->count;
+    queue->depth_samples++;
+
+    *item = queue->items[queue->head];
+    if (queue->payload != NULL) {
+      memcpy(buffer, item->data, item->length);
+      item->data = buffer;
+      queue->free_slots[queue->free_count++] =
+        ((char*) queue->items[queue->head].data - queue->payload) / queue->payload_size;
+    }
+    queue->head = (queue->head + 1) % MEDIA_QUEUE_MAX;
+    queue->count--;
+    found = true;
+  }
+  media_sync_unlock(&queue->sync);
+  return found;
+}
+
+void media_queue_flush(media_queue* queue) {
+  media_sync_lock(&queue->sync);
+  while (queue->count > 0)
+    media_queue_remove(queue, 0, true);
+  media_sync_unlock(&queue->sync);
+}
+
+int media_queue_depth(media_queue* queue) {
+  return __atomic_load_n(&queue->count, __ATOMIC_RELAXED);
+}
+
+uint32_t media_queue_average_depth(media_queue* queue) {
+  return queue->depth_samples ? queue->depth_total * 100 / queue->depth_samples : 0;
+}
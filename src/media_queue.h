@@ -0,0 +1,111 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "media_sync.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bounded queue between a receive thread and a consumer thread.
+//
+// Pushing never blocks. If the queue is full, room is made by dropping the
+// oldest disposable item, or the oldest item if none is disposable. When the
+// consumer gets to them, items that waited longer than max_age are dropped,
+// and only those.
+//
+// Items either point at data the producer manages (payload_size 0; dropped
+// items are handed to the release callback), or the queue keeps its own copy
+// of up to payload_size bytes. Either way every item tells how many were
+// dropped right before it, so the consumer knows where the gaps are.
+//
+// Arrival times are in microseconds by the clock passed to media_queue_init.
+
+#define MEDIA_QUEUE_MAX 16
+
+// no later item depends on this one
+#define MEDIA_ITEM_DISPOSABLE 0x1
+// starts over, nothing before it is needed anymore
+#define MEDIA_ITEM_KEY 0x2
+
+typedef struct {
+  void* data;
+  uint32_t length;
+  void* handle;
+  int number;
+  int flags;
+  uint64_t arrival;
+  // items dropped right before this one: the producer sets those it threw
+  // away before pushing, the queue adds its own drops
+  uint32_t dropped;
+} media_item;
+
+typedef void (*media_queue_release)(media_item* item);
+typedef uint64_t (*media_queue_clock)(void);
+
+typedef struct {
+  media_item items[MEDIA_QUEUE_MAX];
+  int capacity;
+  int head;
+  int count;
+  uint32_t max_age;
+  media_queue_release release;
+  media_queue_clock clock;
+  // dropped after the newest item, they go with the next push
+  uint32_t dropped;
+
+  char* payload;
+  uint32_t payload_size;
+  int free_slots[MEDIA_QUEUE_MAX];
+  int free_count;
+
+  media_sync sync;
+  bool ready;
+
+  // counters, reset by media_queue_init
+  uint32_t pushed;
+  uint32_t dropped_full;
+  uint32_t dropped_age;
+  uint32_t dropped_disposable;
+  // dropped items something after them still depended on
+  uint32_t dropped_required;
+  int max_depth;
+  uint64_t depth_total;
+  uint32_t depth_samples;
+} media_queue;
+
+int media_queue_init(media_queue* queue, const char* name, int capacity, uint32_t payload_size,
+                     uint32_t max_age, media_queue_release release, media_queue_clock clock);
+void media_queue_destroy(media_queue* queue);
+
+// drop items until there is room for one more
+void media_queue_make_room(media_queue* queue);
+void media_queue_push(media_queue* queue, media_item* item);
+
+// Wait up to timeout us for an item. For queues with their own payload the
+// data is copied to buffer, which has to hold payload_size bytes.
+bool media_queue_pop(media_queue* queue, media_item* item, void* buffer, uint32_t timeout);
+
+// drop everything that is queued
+void media_queue_flush(media_queue* queue);
+
+int media_queue_depth(media_queue* queue);
+// average depth seen by the consumer, in hundredths
+uint32_t media_queue_average_depth(media_queue* queue);
@@ -0,0 +1,154 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock and wakeup signal of a media_queue: the kernel's mutex and semaphore
+// on the Vita, pthreads anywhere else, so the queue builds on the host too.
+// Timeouts are in microseconds.
+
+#ifdef __vita__
+
+#include <psp2/kernel/threadmgr.h>
+
+typedef struct {
+  SceUID lock;
+  SceUID signal;
+} media_sync;
+
+static inline int media_sync_init(media_sync* sync, const char* name, int max) {
+  sync->lock = sceKernelCreateMutex(name, 0, 0, NULL);
+  sync->signal = sceKernelCreateSema(name, 0, 0, max, NULL);
+  return sync->lock >= 0 && sync->signal >= 0 ? 0 : -1;
+}
+
+static inline void media_sync_destroy(media_sync* sync) {
+  if (sync->lock >= 0) {
+    sceKernelDeleteMutex(sync->lock);
+    sync->lock = -1;
+  }
+  if (sync->signal >= 0) {
+    sceKernelDeleteSema(sync->signal);
+    sync->signal = -1;
+  }
+}
+
+static inline void media_sync_lock(media_sync* sync) {
+  sceKernelLockMutex(sync->lock, 1, NULL);
+}
+
+static inline void media_sync_unlock(media_sync* sync) {
+  sceKernelUnlockMutex(sync->lock, 1);
+}
+
+static inline void media_sync_signal(media_sync* sync) {
+  sceKernelSignalSema(sync->signal, 1);
+}
+
+// take one signal, waiting up to timeout for it; 0 doesn't wait
+static inline bool media_sync_wait(media_sync* sync, uint32_t timeout) {
+  if (timeout == 0)
+    return sceKernelPollSema(sync->signal, 1) >= 0;
+  SceUInt wait = timeout;
+  return sceKernelWaitSema(sync->signal, 1, &wait) >= 0;
+}
+
+#else
+
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+  bool valid;
+  pthread_mutex_t lock;
+  pthread_mutex_t signal_lock;
+  pthread_cond_t signal;
+  int count;
+  int max;
+} media_sync;
+
+static inline int media_sync_init(media_sync* sync, const char* name, int max) {
+  (void) name;
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&sync->lock, NULL);
+  pthread_mutex_init(&sync->signal_lock, NULL);
+  pthread_cond_init(&sync->signal, &attr);
+  pthread_condattr_destroy(&attr);
+  sync->count = 0;
+  sync->max = max;
+  sync->valid = true;
+  return 0;
+}
+
+static inline void media_sync_destroy(media_sync* sync) {
+  if (!sync->valid)
+    return;
+  pthread_cond_destroy(&sync->signal);
+  pthread_mutex_destroy(&sync->signal_lock);
+  pthread_mutex_destroy(&sync->lock);
+  sync->valid = false;
+}
+
+static inline void media_sync_lock(media_sync* sync) {
+  pthread_mutex_lock(&sync->lock);
+}
+
+static inline void media_sync_unlock(media_sync* sync) {
+  pthread_mutex_unlock(&sync->lock);
+}
+
+static inline void media_sync_signal(media_sync* sync) {
+  pthread_mutex_lock(&sync->signal_lock);
+  if (sync->count < sync->max)
+    sync->count++;
+  pthread_cond_signal(&sync->signal);
+  pthread_mutex_unlock(&sync->signal_lock);
+}
+
+// take one signal, waiting up to timeout for it; 0 doesn't wait
+static inline bool media_sync_wait(media_sync* sync, uint32_t timeout) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout / 1000000;
+  deadline.tv_nsec += (timeout % 1000000) * 1000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&sync->signal_lock);
+  while (sync->count == 0 && timeout > 0) {
+    if (pthread_cond_timedwait(&sync->signal, &sync->signal_lock, &deadline) != 0)
+      break;
+  }
+  bool taken = sync->count > 0;
+  if (taken)
+    sync->count--;
+  pthread_mutex_unlock(&sync->signal_lock);
+  return taken;
+}
+
+#endif
@@ -33,15 +33,38 @@ enum platform platform_check(char* name) {
   bool std = strcmp(name, "default") == 0;
   if (strcmp(name, "vita") == 0)
     return VITA;
+  if (strcmp(name, "null") == 0)
+    return NULLSINK;
+  if (strcmp(name, "dump") == 0)
+    return DUMP;
+  if (strcmp(name, "timing") == 0)
+    return TIMING;
   return 0;
 }
 
 DECODER_RENDERER_CALLBACKS* platform_get_video(enum platform system) {
-  return &decoder_callbacks_vita;
+  switch (system) {
+  case NULLSINK:
+  case TIMING:
+    return &decoder_callbacks_null;
+  case DUMP:
+    return &decoder_callbacks_dump;
+  default:
+    return &decoder_callbacks_vita;
+  }
 }
 
 AUDIO_RENDERER_CALLBACKS* platform_get_audio(enum platform system) {
-  return &audio_callbacks_vita;
+  switch (system) {
+  case NULLSINK:
+    return &audio_callbacks_null;
+  case DUMP:
+    return &audio_callbacks_wav;
+  case TIMING:
+    return &audio_callbacks_timing;
+  default:
+    return &audio_callbacks_vita;
+  }
 }
 
 bool platform_supports_hevc(enum platform system) {
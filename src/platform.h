@@ -24,7 +24,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-enum platform { VITA };
+enum platform { VITA, NULLSINK, DUMP, TIMING };
 
 enum platform platform_check(char*);
 PDECODER_RENDERER_CALLBACKS platform_get_video(enum platform system);
@@ -32,3 +32,5 @@ PAUDIO_RENDERER_CALLBACKS platform_get_audio(enum platform system);
 bool platform_supports_hevc(enum platform system);
 
 extern DECODER_RENDERER_CALLBACKS decoder_callbacks_vita;
+extern DECODER_RENDERER_CALLBACKS decoder_callbacks_null;
+extern DECODER_RENDERER_CALLBACKS decoder_callbacks_dump;
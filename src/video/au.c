@@ -0,0 +1,295 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "au.h"
+#include "sps.h"
+
+#include "bs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// an IDR frame is usually several times larger than the average frame
+#define AU_IDR_FACTOR 8
+// keep slabs aligned to this, it avoids many tiny reallocations
+#define AU_SIZE_ALIGN (16 * 1024)
+// a free slab is grown ahead of time once an AU uses this much of it (in %)
+#define AU_HIGH_WATER 75
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR_SLICE 5
+
+#define SLICE_TYPE_P 0
+#define SLICE_TYPE_B 1
+
+static uint32_t au_align(uint32_t size) {
+  return (size + AU_SIZE_ALIGN - 1) & ~(AU_SIZE_ALIGN - 1);
+}
+
+uint32_t au_estimate_size(int bitrate_kbps, int width, int height, int fps) {
+  if (bitrate_kbps <= 0 || fps <= 0)
+    return AU_MIN_SLAB_SIZE;
+
+  uint64_t average = (uint64_t) bitrate_kbps * 1000 / 8 / fps;
+  uint64_t size = average * AU_IDR_FACTOR;
+
+  // a coded frame is not going to be larger than the raw YUV 4:2:0 picture
+  uint64_t raw = (uint64_t) width * height * 3 / 2;
+  if (raw > 0 && size > raw)
+    size = raw;
+
+  if (size < AU_MIN_SLAB_SIZE)
+    size = AU_MIN_SLAB_SIZE;
+  return au_align(size);
+}
+
+static uint32_t au_grow_size(uint32_t current, uint32_t needed) {
+  uint32_t size = current < AU_MIN_SLAB_SIZE ? AU_MIN_SLAB_SIZE : current;
+  while (size < needed)
+    size *= 2;
+  return au_align(size);
+}
+
+// raise the size the pool wants, it never goes down
+static void au_want_size(au_pool* pool, uint32_t size) {
+  uint32_t wanted = __atomic_load_n(&pool->wanted_size, __ATOMIC_RELAXED);
+  if (size > wanted)
+    __atomic_store_n(&pool->wanted_size, size, __ATOMIC_RELAXED);
+}
+
+static bool au_slab_grow(au_pool* pool, au_slab* slab, uint32_t size) {
+  if (slab->size >= size)
+    return true;
+
+  // the old content is never needed, don't let realloc copy it
+  char* data = malloc(size);
+  if (data == NULL)
+    return false;
+  free(slab->data);
+  slab->data = data;
+  __atomic_store_n(&slab->size, size, __ATOMIC_RELEASE);
+
+  pool->resizes++;
+  if (size > __atomic_load_n(&pool->slab_size, __ATOMIC_RELAXED))
+    __atomic_store_n(&pool->slab_size, size, __ATOMIC_RELAXED);
+  return true;
+}
+
+int au_pool_init(au_pool* pool, int count, uint32_t slab_size) {
+  memset(pool, 0, sizeof(au_pool));
+  if (count > AU_POOL_MAX_SLABS)
+    count = AU_POOL_MAX_SLABS;
+
+  for (int i = 0; i < count; i++) {
+    pool->slabs[i].data = malloc(slab_size);
+    if (pool->slabs[i].data == NULL) {
+      au_pool_destroy(pool);
+      return -1;
+    }
+    pool->slabs[i].size = slab_size;
+    pool->count++;
+  }
+  pool->slab_size = slab_size;
+  pool->wanted_size = slab_size;
+  pool->zero_copy = true;
+  return 0;
+}
+
+void au_pool_destroy(au_pool* pool) {
+  for (int i = 0; i < pool->count; i++) {
+    if (pool->slabs[i].data != NULL) {
+      free(pool->slabs[i].data);
+      pool->slabs[i].data = NULL;
+    }
+  }
+  pool->count = 0;
+}
+
+au_slab* au_pool_acquire(au_pool* pool, uint32_t size) {
+  for (int i = 0; i < pool->count; i++) {
+    // only au_pool_maintain changes the size, and only of slabs it holds
+    if (__atomic_load_n(&pool->slabs[i].size, __ATOMIC_ACQUIRE) < size)
+      continue;
+
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&pool->slabs[i].in_use, &expected, 1,
+                                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return &pool->slabs[i];
+    }
+  }
+  return NULL;
+}
+
+void au_pool_release(au_pool* pool, au_slab* slab) {
+  // the pool stays in the signature so callers pair it with au_pool_acquire
+  (void) pool;
+  if (slab != NULL)
+    __atomic_store_n(&slab->in_use, 0, __ATOMIC_RELEASE);
+}
+
+int au_pool_maintain(au_pool* pool) {
+  uint32_t wanted = __atomic_load_n(&pool->wanted_size, __ATOMIC_RELAXED);
+  int grown = 0;
+
+  for (int i = 0; i < pool->count; i++) {
+    au_slab* slab = &pool->slabs[i];
+    if (slab->size >= wanted)
+      continue;
+
+    // slabs in use are grown on a later call
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&slab->in_use, &expected, 1,
+                                     false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      continue;
+
+    bool ok = au_slab_grow(pool, slab, wanted);
+    au_pool_release(pool, slab);
+    if (!ok)
+      return -1;
+    grown++;
+  }
+  return grown;
+}
+
+bool au_assemble(au_pool* pool, PDECODE_UNIT decodeUnit, int sps_flags, au_frame* out) {
+  PLENTRY entry = decodeUnit->bufferList;
+
+  // Single buffer frames are already contiguous, the decoder can read them
+  // where the depacketizer left them. SPS always needs the rewrite below.
+  if (pool->zero_copy && entry != NULL && entry->next == NULL && entry->bufferType != BUFFER_TYPE_SPS) {
+    out->data = entry->data;
+    out->length = entry->length;
+    out->slab = NULL;
+    out->slices = au_count_slices(decodeUnit);
+    pool->slices += out->slices;
+
+    pool->frames++;
+    pool->zero_copy_frames++;
+    pool->bytes_total += entry->length;
+    if (entry->length >= 0 && (uint32_t) entry->length > pool->largest_au)
+      pool->largest_au = entry->length;
+    return true;
+  }
+
+  uint32_t needed = decodeUnit->fullLength + AU_SPS_SLACK;
+  au_slab* slab = au_pool_acquire(pool, needed);
+  if (slab == NULL) {
+    // free slabs smaller than the largest one are grown too
+    uint32_t slab_size = __atomic_load_n(&pool->slab_size, __ATOMIC_RELAXED);
+    au_want_size(pool, au_grow_size(slab_size, needed));
+    if (needed > slab_size)
+      pool->oversized++;
+    return false;
+  }
+
+  uint32_t length = 0;
+  while (entry != NULL) {
+    if (entry->bufferType == BUFFER_TYPE_SPS) {
+      gs_sps_fix(entry, sps_flags, (uint8_t*) slab->data, &length);
+    } else {
+      memcpy(slab->data + length, entry->data, entry->length);
+      length += entry->length;
+    }
+    entry = entry->next;
+  }
+
+  out->data = slab->data;
+  out->length = length;
+  out->slab = slab;
+  out->slices = au_count_slices(decodeUnit);
+  pool->slices += out->slices;
+
+  pool->frames++;
+  pool->bytes_total += length;
+  pool->bytes_copied += length;
+  if (length > pool->largest_au)
+    pool->largest_au = length;
+
+  // getting close to the end of the slab, have the slabs grown before an AU
+  // that no longer fits shows up
+  if ((uint64_t) needed * 100 > (uint64_t) slab->size * AU_HIGH_WATER)
+    au_want_size(pool, au_grow_size(slab->size, slab->size + 1));
+  return true;
+}
+
+void au_frame_release(au_pool* pool, au_frame* frame) {
+  au_pool_release(pool, frame->slab);
+  frame->slab = NULL;
+}
+
+uint32_t au_pool_average(au_pool* pool) {
+  return pool->frames ? pool->bytes_total / pool->frames : 0;
+}
+
+// Offset of the first NAL header at or after from in entry, -1 if there is
+// none. A 4 byte start code ends in a 3 byte one, so that is all to look for.
+static int au_next_nal(PLENTRY entry, int from) {
+  const unsigned char* data = (const unsigned char*) entry->data;
+  for (int i = from; i + 3 < entry->length; i++) {
+    if (data[i + 2] > 1) {
+      // no start code can end before i + 3
+      i += 2;
+    } else if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+      return i + 3;
+    }
+  }
+  return -1;
+}
+
+uint32_t au_count_slices(PDECODE_UNIT decodeUnit) {
+  uint32_t slices = 0;
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+    if (entry->bufferType != BUFFER_TYPE_PICDATA)
+      continue;
+
+    for (int header = au_next_nal(entry, 0); header >= 0; header = au_next_nal(entry, header + 1)) {
+      int type = entry->data[header] & 0x1f;
+      if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR_SLICE)
+        slices++;
+    }
+  }
+  return slices;
+}
+
+bool au_is_disposable(PDECODE_UNIT decodeUnit) {
+  uint32_t slices = 0;
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+    if (entry->bufferType != BUFFER_TYPE_PICDATA)
+      return false;
+
+    for (int header = au_next_nal(entry, 0); header >= 0; header = au_next_nal(entry, header + 1)) {
+      unsigned char nal = entry->data[header];
+      if ((nal & 0x1f) != NAL_TYPE_SLICE)
+        continue;
+      if ((nal & 0x60) != 0)
+        return false;
+
+      // first_mb_in_slice and slice_type open the slice header and need no
+      // SPS or PPS to read. Emulation prevention can't occur this early.
+      bs_t b;
+      bs_init(&b, (uint8_t*) entry->data + header + 1, entry->length - header - 1);
+      bs_read_ue(&b);
+      uint32_t slice_type = bs_read_ue(&b) % 5;
+      if (bs_overrun(&b) || (slice_type != SLICE_TYPE_P && slice_type != SLICE_TYPE_B))
+        return false;
+      slices++;
+    }
+  }
+  return slices > 0;
+}
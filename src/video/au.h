@@ -0,0 +1,115 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Access unit (AU) assembly for the video path.
+//
+// The depacketizer hands us a frame as a list of LENTRY buffers. The decoder
+// wants one contiguous buffer, so the pool keeps a small set of pre-sized
+// slabs that an AU is gathered into. Frames that already arrive as a single
+// buffer are handed to the decoder in place and never touch a slab.
+//
+// Assembling never allocates, it runs on the receive thread. When AUs get
+// close to the slab size the pool only records the size it wants, and another
+// thread grows the free slabs with au_pool_maintain.
+//
+// Nothing in here depends on the Vita SDK so it can be built on any host.
+
+#define AU_POOL_MAX_SLABS 4
+
+// room for gs_sps_fix to write a rewritten SPS larger than the original one
+#define AU_SPS_SLACK 128
+
+// slabs never shrink below this, it used to be the fixed decoder buffer size
+#define AU_MIN_SLAB_SIZE (92 * 1024)
+
+typedef struct {
+  char* data;
+  uint32_t size;
+  int in_use;
+} au_slab;
+
+typedef struct {
+  au_slab slabs[AU_POOL_MAX_SLABS];
+  int count;
+  // largest slab, written by au_pool_maintain
+  uint32_t slab_size;
+  // size au_pool_maintain grows the free slabs to, raised by au_assemble
+  uint32_t wanted_size;
+  // single buffer frames are passed through without a copy; has to be off
+  // when the AU outlives the decode unit
+  bool zero_copy;
+
+  // counters, reset by au_pool_init
+  uint64_t frames;
+  uint64_t zero_copy_frames;
+  uint64_t bytes_total;
+  uint64_t bytes_copied;
+  uint32_t largest_au;
+  uint32_t resizes;
+  uint32_t oversized;
+  uint64_t slices;
+} au_pool;
+
+typedef struct {
+  const char* data;
+  uint32_t length;
+  au_slab* slab; // NULL when the AU points straight into the decode unit
+  uint32_t slices;
+} au_frame;
+
+// Initial slab size for a stream: a multiple of the average frame at the
+// negotiated bitrate so IDR frames fit, capped by the size of a raw frame.
+uint32_t au_estimate_size(int bitrate_kbps, int width, int height, int fps);
+
+int au_pool_init(au_pool* pool, int count, uint32_t slab_size);
+void au_pool_destroy(au_pool* pool);
+
+// a free slab of at least size bytes, NULL if there is none
+au_slab* au_pool_acquire(au_pool* pool, uint32_t size);
+void au_pool_release(au_pool* pool, au_slab* slab);
+
+// Grow the free slabs to the size the pool wants. May allocate, so call it
+// from a thread where that doesn't hurt, never from the one assembling.
+// Returns the number of slabs grown, -1 if an allocation failed.
+int au_pool_maintain(au_pool* pool);
+
+// Make the AU of decodeUnit contiguous. Returns false if no free slab is
+// large enough; the pool then wants larger slabs and the AU after the next
+// au_pool_maintain fits. out is left untouched in that case.
+bool au_assemble(au_pool* pool, PDECODE_UNIT decodeUnit, int sps_flags, au_frame* out);
+void au_frame_release(au_pool* pool, au_frame* frame);
+
+uint32_t au_pool_average(au_pool* pool);
+
+// Number of slice NAL units among the buffers of decodeUnit. Every start
+// code is looked at, the depacketizer joins a frame's picture data into one
+// buffer.
+uint32_t au_count_slices(PDECODE_UNIT decodeUnit);
+
+// True if no later frame can reference this one: every slice has a
+// nal_ref_idc of 0 and is a P or B slice. Such a frame can be skipped
+// without decoding it and without breaking the frames after it.
+bool au_is_disposable(PDECODE_UNIT decodeUnit);
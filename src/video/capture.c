@@ -0,0 +1,276 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// replay never builds decode units with more buffers than this
+#define CAPTURE_MAX_BUFFERS 64
+#define CAPTURE_INDEX_STEP 1024
+
+static PDECODER_RENDERER_CALLBACKS inner = NULL;
+static DECODER_RENDERER_CALLBACKS capture_callbacks;
+static const char* capture_path = NULL;
+static FILE* fd = NULL;
+static uint64_t* index_offsets = NULL;
+static uint32_t index_count, index_size;
+
+bool capture_write_header(FILE* fd, int video_format, int width, int height, int fps) {
+  capture_header header = {0};
+  memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  header.video_format = video_format;
+  header.width = width;
+  header.height = height;
+  header.fps = fps;
+  return fwrite(&header, sizeof(header), 1, fd) == 1;
+}
+
+bool capture_write_record(FILE* fd, PDECODE_UNIT decodeUnit, uint64_t arrival_us) {
+  capture_record record = {0};
+  record.frame_number = decodeUnit->frameNumber;
+  record.full_length = decodeUnit->fullLength;
+  record.arrival_us = arrival_us;
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next)
+    record.buffer_count++;
+
+  if (fwrite(&record, sizeof(record), 1, fd) != 1)
+    return false;
+
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+    capture_buffer buffer = { .type = entry->bufferType, .length = entry->length };
+    if (fwrite(&buffer, sizeof(buffer), 1, fd) != 1 ||
+        fwrite(entry->data, entry->length, 1, fd) != 1)
+      return false;
+  }
+  return true;
+}
+
+static void capture_close() {
+  if (fd == NULL)
+    return;
+
+  capture_trailer trailer = {0};
+  trailer.index_offset = ftell(fd);
+  trailer.count = index_count;
+  memcpy(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic));
+  fwrite(index_offsets, sizeof(uint64_t), index_count, fd);
+  fwrite(&trailer, sizeof(trailer), 1, fd);
+  fclose(fd);
+  fd = NULL;
+
+  free(index_offsets);
+  index_offsets = NULL;
+  index_count = index_size = 0;
+}
+
+static int capture_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  fd = fopen(capture_path, "wb");
+  if (fd == NULL || !capture_write_header(fd, videoFormat, width, height, redrawRate)) {
+    printf("capture: can't write %s\n", capture_path);
+    if (fd != NULL) {
+      fclose(fd);
+      fd = NULL;
+    }
+  }
+  return inner->setup ? inner->setup(videoFormat, width, height, redrawRate, context, drFlags) : 0;
+}
+
+static void capture_start() {
+  if (inner->start)
+    inner->start();
+}
+
+static void capture_stop() {
+  if (inner->stop)
+    inner->stop();
+}
+
+static void capture_cleanup() {
+  capture_close();
+  if (inner->cleanup)
+    inner->cleanup();
+}
+
+static int capture_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  if (fd != NULL) {
+    if (index_count == index_size) {
+      uint64_t* offsets = realloc(index_offsets, (index_size + CAPTURE_INDEX_STEP) * sizeof(uint64_t));
+      if (offsets != NULL) {
+        index_offsets = offsets;
+        index_size += CAPTURE_INDEX_STEP;
+      }
+    }
+
+    long offset = ftell(fd);
+    if (!capture_write_record(fd, decodeUnit, (uint64_t) decodeUnit->receiveTimeMs * 1000)) {
+      printf("capture: write failed, stopping after %u frames\n", index_count);
+      capture_close();
+    } else if (index_count < index_size) {
+      index_offsets[index_count++] = offset;
+    }
+  }
+  return inner->submitDecodeUnit(decodeUnit);
+}
+
+PDECODER_RENDERER_CALLBACKS capture_wrap(PDECODER_RENDERER_CALLBACKS callbacks, const char* path) {
+  inner = callbacks;
+  capture_path = path;
+
+  capture_callbacks.setup = capture_setup;
+  capture_callbacks.start = capture_start;
+  capture_callbacks.stop = capture_stop;
+  capture_callbacks.cleanup = capture_cleanup;
+  capture_callbacks.submitDecodeUnit = capture_submit_decode_unit;
+  capture_callbacks.capabilities = callbacks->capabilities;
+  return &capture_callbacks;
+}
+
+static uint64_t capture_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void capture_sleep(uint64_t us) {
+  struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = us % 1000000 * 1000 };
+  nanosleep(&ts, NULL);
+}
+
+// Offset the records end at: where the index starts if the trailer is intact,
+// the end of the file otherwise.
+static long capture_records_end(FILE* in) {
+  if (fseek(in, 0, SEEK_END) != 0)
+    return -1;
+  long size = ftell(in);
+
+  capture_trailer trailer;
+  if (size >= (long) (sizeof(capture_header) + sizeof(trailer)) &&
+      fseek(in, size - sizeof(trailer), SEEK_SET) == 0 &&
+      fread(&trailer, sizeof(trailer), 1, in) == 1 &&
+      memcmp(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic)) == 0 &&
+      trailer.index_offset >= sizeof(capture_header) &&
+      trailer.index_offset + (uint64_t) trailer.count * sizeof(uint64_t) + sizeof(trailer) == (uint64_t) size)
+    return trailer.index_offset;
+  return size;
+}
+
+int capture_replay(const char* path, PDECODER_RENDERER_CALLBACKS callbacks, void* context,
+                   bool realtime, bool* complete) {
+  FILE* in = fopen(path, "rb");
+  if (in == NULL)
+    return -1;
+
+  capture_header header;
+  long end = capture_records_end(in);
+  if (end < 0 || fseek(in, 0, SEEK_SET) != 0 ||
+      fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0) {
+    fclose(in);
+    return -1;
+  }
+
+  if (callbacks->setup &&
+      callbacks->setup(header.video_format, header.width, header.height, header.fps, context, 0) != 0) {
+    fclose(in);
+    return -1;
+  }
+  if (callbacks->start)
+    callbacks->start();
+
+  LENTRY entries[CAPTURE_MAX_BUFFERS];
+  char* data = NULL;
+  uint32_t data_size = 0;
+  uint64_t first_arrival = 0, started = capture_now();
+  int frames = 0;
+  bool ok = true;
+
+  for (long position = sizeof(header); position < end; position = ftell(in)) {
+    capture_record record;
+    ok = end - position >= (long) sizeof(record) && fread(&record, sizeof(record), 1, in) == 1 &&
+         record.buffer_count <= CAPTURE_MAX_BUFFERS;
+
+    // all buffers of a unit go into one allocation, entries only keep their
+    // offset into it until it stops growing
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < record.buffer_count && ok; i++) {
+      capture_buffer buffer;
+      ok = fread(&buffer, sizeof(buffer), 1, in) == 1 &&
+           buffer.length <= (uint64_t) (end - ftell(in));
+      if (ok && length + buffer.length > data_size) {
+        char* grown = realloc(data, length + buffer.length);
+        ok = grown != NULL;
+        if (ok) {
+          data = grown;
+          data_size = length + buffer.length;
+        }
+      }
+      ok = ok && fread(data + length, 1, buffer.length, in) == buffer.length;
+
+      entries[i].next = i + 1 < record.buffer_count ? &entries[i + 1] : NULL;
+      entries[i].length = buffer.length;
+      entries[i].bufferType = buffer.type;
+      length += buffer.length;
+    }
+    if (!ok || length != record.full_length) {
+      ok = false;
+      break;
+    }
+    // nothing to decode
+    if (record.buffer_count == 0)
+      continue;
+
+    for (uint32_t i = 0, offset = 0; i < record.buffer_count; offset += entries[i++].length)
+      entries[i].data = data + offset;
+
+    DECODE_UNIT decodeUnit;
+    memset(&decodeUnit, 0, sizeof(decodeUnit));
+    decodeUnit.frameNumber = record.frame_number;
+    decodeUnit.receiveTimeMs = record.arrival_us / 1000;
+    decodeUnit.fullLength = record.full_length;
+    decodeUnit.bufferList = entries;
+
+    if (realtime) {
+      if (frames == 0)
+        first_arrival = record.arrival_us;
+      uint64_t due = started + (record.arrival_us > first_arrival ? record.arrival_us - first_arrival : 0);
+      uint64_t now = capture_now();
+      if (due > now)
+        capture_sleep(due - now);
+    }
+
+    callbacks->submitDecodeUnit(&decodeUnit);
+    frames++;
+  }
+  if (!ok)
+    printf("capture: %s is cut short or corrupt after %d frames\n", path, frames);
+
+  if (callbacks->stop)
+    callbacks->stop();
+  if (callbacks->cleanup)
+    callbacks->cleanup();
+
+  free(data);
+  fclose(in);
+  if (complete != NULL)
+    *complete = ok;
+  return frames;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Decode unit capture and replay.
+//
+// A capture file holds every decode unit exactly as it reached
+// submitDecodeUnit: its buffer list with the buffer types, and the time it
+// arrived. Layout, all little endian:
+//
+//   header   capture_header
+//   records  capture_record, then per buffer a capture_buffer and its data
+//   index    one uint64_t file offset per record
+//   trailer  capture_trailer
+//
+// Records can be read one after the other without the index, so a capture
+// that was never closed properly can still be replayed. When the trailer is
+// there, its index offset is where the records end.
+
+#define CAPTURE_MAGIC "MLDUCAP1"
+#define CAPTURE_INDEX_MAGIC "MLIX"
+
+typedef struct {
+  char magic[8];
+  uint32_t video_format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+} capture_header;
+
+typedef struct {
+  int32_t frame_number;
+  uint32_t buffer_count;
+  uint32_t full_length;
+  uint32_t reserved;
+  uint64_t arrival_us;
+} capture_record;
+
+typedef struct {
+  uint32_t type;
+  uint32_t length;
+} capture_buffer;
+
+typedef struct {
+  uint64_t index_offset;
+  uint32_t count;
+  char magic[4];
+} capture_trailer;
+
+// Returns callbacks that record into path and pass everything on to
+// callbacks. Only one capture can run at a time.
+PDECODER_RENDERER_CALLBACKS capture_wrap(PDECODER_RENDERER_CALLBACKS callbacks, const char* path);
+
+// Feed the decode units of a capture into callbacks, at the recorded pace if
+// realtime is set or as fast as they are taken otherwise. context is passed
+// on to setup. Returns the number of decode units replayed, or -1 if the file
+// can't be read. complete is cleared if the records stop early because one
+// is cut short or corrupt.
+int capture_replay(const char* path, PDECODER_RENDERER_CALLBACKS callbacks, void* context,
+                   bool realtime, bool* complete);
+
+// Low level access, also used by anything else writing this format
+bool capture_write_header(FILE* fd, int video_format, int width, int height, int fps);
+bool capture_write_record(FILE* fd, PDECODE_UNIT decodeUnit, uint64_t arrival_us);
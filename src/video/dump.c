@@ -0,0 +1,116 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../video.h"
+
+#include <Limelight.h>
+#include "au.h"
+#include "sps.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+// Writes the stream to an Annex-B file, after the same AU assembly and SPS
+// fixup the Vita decoder gets, plus a text index with one line per AU:
+//   frame number, receive time (ms), offset, length, 1 if it carries an SPS
+
+#define DUMP_BUFFER_COUNT 1
+
+static FILE* fd = NULL;
+static FILE* index_fd = NULL;
+static const char* fileName = "ux0:data/moonlight/stream.h264";
+static au_pool dump_pool = {0};
+static uint64_t offset;
+
+static void dump_cleanup() {
+  if (fd != NULL) {
+    fclose(fd);
+    fd = NULL;
+  }
+  if (index_fd != NULL) {
+    fclose(index_fd);
+    index_fd = NULL;
+  }
+  if (dump_pool.count > 0) {
+    printf("dump video: %" PRIu64 " frames, %" PRIu64 " bytes, largest AU %u\n",
+           dump_pool.frames, dump_pool.bytes_total, dump_pool.largest_au);
+    au_pool_destroy(&dump_pool);
+  }
+  gs_sps_stop();
+}
+
+static int dump_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  (void) videoFormat;
+  (void) drFlags;
+  const char* path = context != NULL ? context : fileName;
+  char index_path[256];
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+  gs_sps_init(width, height);
+  offset = 0;
+
+  fd = fopen(path, "wb");
+  index_fd = fopen(index_path, "w");
+  if (fd == NULL || index_fd == NULL) {
+    printf("dump video: can't open %s\n", path);
+    dump_cleanup();
+    return -1;
+  }
+
+  // slabs grow to the largest AU on their own, no need to guess the bitrate
+  if (au_pool_init(&dump_pool, DUMP_BUFFER_COUNT, AU_MIN_SLAB_SIZE) < 0) {
+    printf("dump video: not enough memory\n");
+    dump_cleanup();
+    return -1;
+  }
+
+  printf("dump video %dx%d@%d to %s\n", width, height, redrawRate, path);
+  return 0;
+}
+
+static int dump_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  bool sps = false;
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+    if (entry->bufferType == BUFFER_TYPE_SPS)
+      sps = true;
+  }
+
+  // nothing here is time critical, grow the slabs right before they're used
+  au_frame frame;
+  if (!au_assemble(&dump_pool, decodeUnit, GS_SPS_BITSTREAM_FIXUP, &frame) &&
+      (au_pool_maintain(&dump_pool) < 0 ||
+       !au_assemble(&dump_pool, decodeUnit, GS_SPS_BITSTREAM_FIXUP, &frame)))
+    return DR_NEED_IDR;
+
+  fwrite(frame.data, frame.length, 1, fd);
+  fprintf(index_fd, "%d %" PRIu64 " %" PRIu64 " %u %d\n", decodeUnit->frameNumber,
+          (uint64_t) decodeUnit->receiveTimeMs, offset, frame.length, sps);
+  offset += frame.length;
+
+  au_frame_release(&dump_pool, &frame);
+  return DR_OK;
+}
+
+DECODER_RENDERER_CALLBACKS decoder_callbacks_dump = {
+  .setup = dump_setup,
+  .cleanup = dump_cleanup,
+  .submitDecodeUnit = dump_submit_decode_unit,
+  .capabilities = CAPABILITY_DIRECT_SUBMIT,
+};
@@ -0,0 +1,152 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "forensic.h"
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int forensic_init(forensic_ring* ring, int video_format, int width, int height, int fps) {
+  memset(ring, 0, sizeof(forensic_ring));
+  ring->arena = malloc(FORENSIC_ARENA_SIZE);
+  if (ring->arena == NULL)
+    return -1;
+
+  ring->video_format = video_format;
+  ring->width = width;
+  ring->height = height;
+  ring->fps = fps;
+  return 0;
+}
+
+void forensic_destroy(forensic_ring* ring) {
+  if (ring->arena != NULL) {
+    free(ring->arena);
+    ring->arena = NULL;
+  }
+}
+
+// drop every entry whose data overlaps [offset, offset + length)
+static void forensic_evict(forensic_ring* ring, uint32_t offset, uint32_t length) {
+  for (int i = 0; i < FORENSIC_ENTRIES; i++) {
+    forensic_entry* entry = &ring->entries[i];
+    if (entry->valid && entry->offset < offset + length && offset < entry->offset + entry->length) {
+      entry->valid = false;
+      ring->evicted++;
+    }
+  }
+}
+
+void forensic_record(forensic_ring* ring, PDECODE_UNIT decodeUnit, uint64_t arrival_us) {
+  if (ring->arena == NULL)
+    return;
+
+  forensic_entry* entry = &ring->entries[ring->next];
+  ring->next = (ring->next + 1) % FORENSIC_ENTRIES;
+  entry->valid = false;
+
+  uint32_t length = 0;
+  for (PLENTRY buffer = decodeUnit->bufferList; buffer != NULL; buffer = buffer->next)
+    length += buffer->length;
+  if (length > FORENSIC_ARENA_SIZE) {
+    ring->oversized++;
+    return;
+  }
+
+  if (ring->write_offset + length > FORENSIC_ARENA_SIZE)
+    ring->write_offset = 0;
+  forensic_evict(ring, ring->write_offset, length);
+
+  entry->frame_number = decodeUnit->frameNumber;
+  entry->arrival_us = arrival_us;
+  entry->offset = ring->write_offset;
+  entry->length = length;
+  entry->buffer_count = 0;
+
+  char* data = ring->arena + ring->write_offset;
+  for (PLENTRY buffer = decodeUnit->bufferList; buffer != NULL; buffer = buffer->next) {
+    memcpy(data, buffer->data, buffer->length);
+    data += buffer->length;
+
+    if (entry->buffer_count < FORENSIC_MAX_BUFFERS) {
+      entry->buffers[entry->buffer_count].type = buffer->bufferType;
+      entry->buffers[entry->buffer_count].length = buffer->length;
+      entry->buffer_count++;
+    } else {
+      entry->buffers[FORENSIC_MAX_BUFFERS - 1].length += buffer->length;
+    }
+  }
+
+  ring->write_offset += length;
+  entry->valid = true;
+  ring->recorded++;
+}
+
+int forensic_flush(forensic_ring* ring, const char* path) {
+  FILE* fd = fopen(path, "wb");
+  if (fd == NULL)
+    return -1;
+
+  bool ok = capture_write_header(fd, ring->video_format, ring->width, ring->height, ring->fps);
+  uint64_t offsets[FORENSIC_ENTRIES];
+  uint32_t count = 0;
+
+  for (int i = 0; i < FORENSIC_ENTRIES && ok; i++) {
+    forensic_entry* entry = &ring->entries[(ring->next + i) % FORENSIC_ENTRIES];
+    if (!entry->valid)
+      continue;
+
+    // rebuild the decode unit so it is written exactly like a live capture
+    LENTRY buffers[FORENSIC_MAX_BUFFERS];
+    char* data = ring->arena + entry->offset;
+    for (uint32_t j = 0; j < entry->buffer_count; j++) {
+      buffers[j].next = j + 1 < entry->buffer_count ? &buffers[j + 1] : NULL;
+      buffers[j].data = data;
+      buffers[j].length = entry->buffers[j].length;
+      buffers[j].bufferType = entry->buffers[j].type;
+      data += entry->buffers[j].length;
+    }
+
+    DECODE_UNIT decodeUnit = {0};
+    decodeUnit.frameNumber = entry->frame_number;
+    decodeUnit.receiveTimeMs = entry->arrival_us / 1000;
+    decodeUnit.fullLength = entry->length;
+    decodeUnit.bufferList = entry->buffer_count > 0 ? buffers : NULL;
+
+    offsets[count] = ftell(fd);
+    ok = capture_write_record(fd, &decodeUnit, entry->arrival_us);
+    count++;
+  }
+
+  if (ok) {
+    capture_trailer trailer = {0};
+    trailer.index_offset = ftell(fd);
+    trailer.count = count;
+    memcpy(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic));
+    ok = fwrite(offsets, sizeof(uint64_t), count, fd) == count &&
+         fwrite(&trailer, sizeof(trailer), 1, fd) == 1;
+  }
+  if (fclose(fd) != 0)
+    ok = false;
+
+  ring->flushes++;
+  return ok ? (int) count : -1;
+}
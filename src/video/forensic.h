@@ -0,0 +1,83 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decode history for post-mortem analysis of decoder errors.
+//
+// The last FORENSIC_ENTRIES decode units are kept with their buffer lists and
+// arrival times, in memory that is allocated once up front. AUs are copied
+// into a circular arena; an AU that needs space still held by older ones
+// evicts them. When the decoder fails the history is flushed as a capture
+// file (see capture.h), which capture_replay can feed straight back into the
+// decoder callbacks.
+//
+// Not thread safe: record and flush have to happen on the same thread.
+
+#define FORENSIC_ENTRIES 32
+// buffers past this are merged into the last one
+#define FORENSIC_MAX_BUFFERS 16
+#define FORENSIC_ARENA_SIZE (2 * 1024 * 1024)
+
+typedef struct {
+  uint32_t type;
+  uint32_t length;
+} forensic_buffer;
+
+typedef struct {
+  bool valid;
+  int32_t frame_number;
+  uint64_t arrival_us;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t buffer_count;
+  forensic_buffer buffers[FORENSIC_MAX_BUFFERS];
+} forensic_entry;
+
+typedef struct {
+  char* arena;
+  uint32_t write_offset;
+  forensic_entry entries[FORENSIC_ENTRIES];
+  int next;
+
+  int video_format;
+  int width;
+  int height;
+  int fps;
+
+  // counters, reset by forensic_init
+  uint32_t recorded;
+  uint32_t evicted;
+  uint32_t oversized;
+  uint32_t flushes;
+} forensic_ring;
+
+int forensic_init(forensic_ring* ring, int video_format, int width, int height, int fps);
+void forensic_destroy(forensic_ring* ring);
+
+void forensic_record(forensic_ring* ring, PDECODE_UNIT decodeUnit, uint64_t arrival_us);
+
+// Write the history to path, oldest decode unit first. Returns the number of
+// decode units written or -1 if the file can't be written.
+int forensic_flush(forensic_ring* ring, const char* path);
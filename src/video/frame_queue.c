@@ -0,0 +1,55 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame_queue.h"
+
+// set on the middle slot while it holds a frame the render thread hasn't seen
+#define FRAME_QUEUE_FRESH 0x100
+#define FRAME_QUEUE_SLOT(x) ((x) & 0xff)
+
+void frame_queue_init(frame_queue* queue) {
+  queue->write = 0;
+  queue->present = 1;
+  __atomic_store_n(&queue->ready, 2, __ATOMIC_RELEASE);
+}
+
+int frame_queue_write_slot(frame_queue* queue) {
+  return queue->write;
+}
+
+bool frame_queue_publish(frame_queue* queue) {
+  int old = __atomic_exchange_n(&queue->ready, queue->write | FRAME_QUEUE_FRESH, __ATOMIC_ACQ_REL);
+  queue->write = FRAME_QUEUE_SLOT(old);
+  return (old & FRAME_QUEUE_FRESH) != 0;
+}
+
+bool frame_queue_acquire(frame_queue* queue) {
+  if ((__atomic_load_n(&queue->ready, __ATOMIC_ACQUIRE) & FRAME_QUEUE_FRESH) == 0)
+    return false;
+
+  // only the decoder writes fresh values, so the middle slot is still fresh
+  // here even if a newer frame was published in between
+  int old = __atomic_exchange_n(&queue->ready, queue->present, __ATOMIC_ACQ_REL);
+  queue->present = FRAME_QUEUE_SLOT(old);
+  return true;
+}
+
+int frame_queue_present_slot(frame_queue* queue) {
+  return queue->present;
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Triple buffer between the decoder and the render thread.
+//
+// There are three slots: one the decoder writes into, one the render thread
+// presents, and one in the middle holding the newest complete frame. Both
+// sides only ever swap their own slot with the middle one, so neither blocks
+// the other. A frame published before the previous one was picked up replaces
+// it, which means the render thread always gets the newest complete frame.
+//
+// Single producer, single consumer. No platform dependencies.
+
+#define FRAME_QUEUE_SIZE 3
+
+typedef struct {
+  int write;
+  int present;
+  int ready;
+} frame_queue;
+
+void frame_queue_init(frame_queue* queue);
+
+// slot the decoder should decode the next frame into
+int frame_queue_write_slot(frame_queue* queue);
+// hand the write slot to the render thread; returns true if this replaced a
+// frame that was never presented
+bool frame_queue_publish(frame_queue* queue);
+
+// take the newest published frame; returns false if nothing new arrived
+bool frame_queue_acquire(frame_queue* queue);
+// slot the render thread should present
+int frame_queue_present_slot(frame_queue* queue);
@@ -0,0 +1,101 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LATENCY_SLOT(frame) ((frame) & (LATENCY_RING_SIZE - 1))
+// frame numbers start at 1, a zeroed slot never matches
+#define LATENCY_NO_FRAME 0
+
+void latency_ring_init(latency_ring* ring) {
+  memset(ring, 0, sizeof(latency_ring));
+}
+
+void latency_begin(latency_ring* ring, uint32_t frame, uint64_t received) {
+  latency_entry* entry = &ring->entries[LATENCY_SLOT(frame)];
+
+  // readers must not pair the new frame number with the old stamps
+  __atomic_store_n(&entry->frame, LATENCY_NO_FRAME, __ATOMIC_RELEASE);
+  for (int i = 0; i < LATENCY_STAGES; i++)
+    __atomic_store_n(&entry->stamp[i], 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->stamp[LATENCY_RECEIVED], received, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->frame, frame, __ATOMIC_RELEASE);
+}
+
+void latency_mark(latency_ring* ring, uint32_t frame, latency_stage stage, uint64_t time) {
+  latency_entry* entry = &ring->entries[LATENCY_SLOT(frame)];
+  if (__atomic_load_n(&entry->frame, __ATOMIC_ACQUIRE) == frame)
+    __atomic_store_n(&entry->stamp[stage], time, __ATOMIC_RELEASE);
+}
+
+uint64_t latency_stamp(latency_ring* ring, uint32_t frame, latency_stage stage) {
+  latency_entry* entry = &ring->entries[LATENCY_SLOT(frame)];
+  if (__atomic_load_n(&entry->frame, __ATOMIC_ACQUIRE) != frame)
+    return 0;
+  uint64_t stamp = __atomic_load_n(&entry->stamp[stage], __ATOMIC_ACQUIRE);
+  // the slot may have been claimed by a newer frame while reading
+  return __atomic_load_n(&entry->frame, __ATOMIC_ACQUIRE) == frame ? stamp : 0;
+}
+
+static int latency_compare(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void latency_percentile(uint32_t* values, uint32_t count, latency_percentiles* out) {
+  memset(out, 0, sizeof(latency_percentiles));
+  out->samples = count;
+  if (count == 0)
+    return;
+
+  qsort(values, count, sizeof(uint32_t), latency_compare);
+  out->p50 = values[(count - 1) * 50 / 100];
+  out->p95 = values[(count - 1) * 95 / 100];
+  out->p99 = values[(count - 1) * 99 / 100];
+}
+
+void latency_summary(latency_ring* ring, latency_percentiles stats[LATENCY_STAGES]) {
+  uint32_t values[LATENCY_RING_SIZE];
+
+  for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+    int from = stage == LATENCY_RECEIVED ? LATENCY_RECEIVED : stage - 1;
+    int to = stage == LATENCY_RECEIVED ? LATENCY_SWAPPED : stage;
+    uint32_t count = 0;
+
+    for (int i = 0; i < LATENCY_RING_SIZE; i++) {
+      latency_entry* entry = &ring->entries[i];
+      uint32_t frame = __atomic_load_n(&entry->frame, __ATOMIC_ACQUIRE);
+      if (frame == LATENCY_NO_FRAME)
+        continue;
+
+      uint64_t start = __atomic_load_n(&entry->stamp[from], __ATOMIC_ACQUIRE);
+      uint64_t end = __atomic_load_n(&entry->stamp[to], __ATOMIC_ACQUIRE);
+      // skip frames that were reused while we looked, or never got that far
+      if (__atomic_load_n(&entry->frame, __ATOMIC_ACQUIRE) != frame)
+        continue;
+      if (start == 0 || end < start)
+        continue;
+      values[count++] = end - start;
+    }
+    latency_percentile(values, count, &stats[stage]);
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Per-frame latency breakdown.
+//
+// Every frame gets a slot in a fixed ring, picked by its frame number, and
+// each stage of the pipeline stamps its time into that slot. Different
+// threads write different stages, so nothing needs a lock; a stamp for a
+// frame whose slot was already reused is dropped. Percentiles are computed
+// on demand over whatever the ring currently holds, which makes them a
+// rolling window of the last LATENCY_RING_SIZE frames.
+//
+// Times are in microseconds and passed in by the caller.
+
+#define LATENCY_RING_SIZE 256
+
+typedef enum {
+  LATENCY_RECEIVED,
+  LATENCY_SUBMITTED,
+  LATENCY_DECODED,
+  LATENCY_DRAWN,
+  LATENCY_SWAPPED,
+  LATENCY_STAGES,
+} latency_stage;
+
+typedef struct {
+  uint32_t frame;
+  uint64_t stamp[LATENCY_STAGES];
+} latency_entry;
+
+typedef struct {
+  latency_entry entries[LATENCY_RING_SIZE];
+} latency_ring;
+
+typedef struct {
+  uint32_t p50;
+  uint32_t p95;
+  uint32_t p99;
+  uint32_t samples;
+} latency_percentiles;
+
+void latency_ring_init(latency_ring* ring);
+
+// claim the slot of a new frame, this has to happen before any latency_mark
+void latency_begin(latency_ring* ring, uint32_t frame, uint64_t received);
+void latency_mark(latency_ring* ring, uint32_t frame, latency_stage stage, uint64_t time);
+// 0 if the frame's slot was reused or the stage wasn't stamped yet
+uint64_t latency_stamp(latency_ring* ring, uint32_t frame, latency_stage stage);
+
+// stats[stage] is the time from the previous stage to stage, except
+// stats[LATENCY_RECEIVED] which covers the whole way from receive to swap
+void latency_summary(latency_ring* ring, latency_percentiles stats[LATENCY_STAGES]);
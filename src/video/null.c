@@ -0,0 +1,70 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../video.h"
+
+#include <Limelight.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Accepts every decode unit and only counts it. Useful to measure the
+// network and depacketizer side without any decoder in the way.
+
+static uint64_t frames, bytes, sps_frames;
+static uint64_t first_receive, last_receive;
+
+static int null_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  (void) videoFormat;
+  (void) context;
+  (void) drFlags;
+  frames = bytes = sps_frames = 0;
+  first_receive = last_receive = 0;
+  printf("null video setup %dx%d@%d\n", width, height, redrawRate);
+  return 0;
+}
+
+static void null_cleanup() {
+  uint64_t duration = last_receive - first_receive;
+  printf("null video: %" PRIu64 " frames, %" PRIu64 " with SPS, %" PRIu64 " bytes\n", frames, sps_frames, bytes);
+  if (duration > 0)
+    printf("null video: %" PRIu64 " fps, %" PRIu64 " kbps\n", frames * 1000 / duration, bytes * 8 / duration);
+}
+
+static int null_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  if (frames == 0)
+    first_receive = decodeUnit->receiveTimeMs;
+  last_receive = decodeUnit->receiveTimeMs;
+
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+    if (entry->bufferType == BUFFER_TYPE_SPS)
+      sps_frames++;
+    bytes += entry->length;
+  }
+  frames++;
+  return DR_OK;
+}
+
+DECODER_RENDERER_CALLBACKS decoder_callbacks_null = {
+  .setup = null_setup,
+  .cleanup = null_cleanup,
+  .submitDecodeUnit = null_submit_decode_unit,
+  .capabilities = CAPABILITY_DIRECT_SUBMIT,
+};
@@ -0,0 +1,131 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pacer.h"
+
+#include <string.h>
+
+// never drop more than this many frames in a row, the picture would freeze
+#define PACER_MAX_DROPS 2
+// a held frame is drawn this long after the vblank it waits for
+#define PACER_HOLD_GUARD 500
+// a drop counts as overload for this long
+#define PACER_OVERLOAD_WINDOW 1000000
+
+void pacer_init(frame_pacer* pacer, uint32_t target_latency, uint32_t period, uint32_t margin) {
+  memset(pacer, 0, sizeof(frame_pacer));
+  pacer->target_latency = target_latency;
+  pacer->period = period;
+  pacer->margin = margin;
+}
+
+void pacer_vblank(frame_pacer* pacer, uint32_t vcount, uint64_t now) {
+  uint64_t vblank_time = pacer->vblank_time;
+  uint32_t elapsed = vcount - pacer->vblank_count;
+  uint32_t period = pacer->period;
+
+  if (vblank_time != 0 && elapsed > 0 && now > vblank_time) {
+    uint64_t measured = (now - vblank_time) / elapsed;
+    // a late wakeup shows up as a long period, don't let it into the average
+    if (measured * 4 > (uint64_t) period * 3 && measured * 4 < (uint64_t) period * 5)
+      period = (period * 15 + (uint32_t) measured) / 16;
+  }
+
+  __atomic_add_fetch(&pacer->seq, 1, __ATOMIC_ACQ_REL);
+  pacer->vblank_time = now;
+  pacer->vblank_count = vcount;
+  pacer->period = period;
+  __atomic_add_fetch(&pacer->seq, 1, __ATOMIC_RELEASE);
+}
+
+static bool pacer_model(frame_pacer* pacer, uint64_t* vblank_time, uint32_t* vblank_count, uint32_t* period) {
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n(&pacer->seq, __ATOMIC_ACQUIRE);
+    *vblank_time = pacer->vblank_time;
+    *vblank_count = pacer->vblank_count;
+    *period = pacer->period;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&pacer->seq, __ATOMIC_RELAXED));
+  return *vblank_time != 0 && *period != 0;
+}
+
+static void pacer_account(frame_pacer* pacer, uint64_t latency) {
+  pacer->latency_total += latency;
+  if (latency > pacer->latency_max)
+    pacer->latency_max = latency;
+}
+
+pacer_action pacer_decide(frame_pacer* pacer, uint64_t frame_time, uint64_t now, uint64_t* present_at) {
+  uint64_t vblank_time;
+  uint32_t vblank_count, period;
+  *present_at = now;
+
+  if (!pacer_model(pacer, &vblank_time, &vblank_count, &period)) {
+    // no vblank seen yet, nothing to align to
+    pacer->presented++;
+    return PACER_PRESENT;
+  }
+
+  // first vblank a frame drawn right now can make it to
+  uint64_t ready = now + pacer->margin;
+  uint32_t ahead = ready > vblank_time ? (ready - vblank_time) / period + 1 : 1;
+  uint32_t target = vblank_count + ahead;
+  uint64_t target_time = vblank_time + (uint64_t) ahead * period;
+
+  // the previous frame is still queued for that vblank, this one would
+  // replace it before it was ever shown
+  uint32_t wait = 0;
+  if (pacer->queued && (int32_t) (target - pacer->last_target) <= 0) {
+    wait = pacer->last_target + 1 - target;
+    target += wait;
+    target_time += (uint64_t) wait * period;
+  }
+
+  uint64_t latency = target_time > frame_time ? target_time - frame_time : 0;
+  if (wait > 0 && latency > pacer->target_latency && pacer->drops_in_row < PACER_MAX_DROPS) {
+    pacer->drops_in_row++;
+    pacer->dropped++;
+    __atomic_store_n(&pacer->last_drop, now, __ATOMIC_RELAXED);
+    return PACER_DROP;
+  }
+
+  pacer->drops_in_row = 0;
+  pacer->last_target = target;
+  pacer->queued = true;
+  pacer_account(pacer, latency);
+
+  if (wait > 0) {
+    *present_at = target_time - period + PACER_HOLD_GUARD;
+    pacer->held++;
+    return PACER_HOLD;
+  }
+  pacer->presented++;
+  return PACER_PRESENT;
+}
+
+bool pacer_overloaded(frame_pacer* pacer, uint64_t now) {
+  uint64_t last_drop = __atomic_load_n(&pacer->last_drop, __ATOMIC_RELAXED);
+  return last_drop != 0 && now - last_drop < PACER_OVERLOAD_WINDOW;
+}
+
+uint32_t pacer_average_latency(frame_pacer* pacer) {
+  uint32_t frames = pacer->presented + pacer->held;
+  return frames ? pacer->latency_total / frames : 0;
+}
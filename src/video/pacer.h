@@ -0,0 +1,82 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-frame pacing against the display refresh.
+//
+// One thread feeds vblank timestamps in, which keeps an estimate of the
+// refresh period and of when the last vblank happened. For every decoded
+// frame the render thread then asks which vblank the frame would be shown on
+// if it were drawn right away. If the previous frame is still queued for that
+// vblank, the new one has to wait for the next vblank (hold); if waiting would
+// push its latency past the target, it is dropped instead and the display
+// keeps the previous frame one vblank longer.
+//
+// All times are in microseconds and passed in by the caller, so there are no
+// platform dependencies.
+
+typedef enum {
+  PACER_PRESENT,
+  PACER_HOLD,
+  PACER_DROP,
+} pacer_action;
+
+typedef struct {
+  // vblank model, written by pacer_vblank and guarded by seq
+  uint32_t seq;
+  uint64_t vblank_time;
+  uint32_t vblank_count;
+  uint32_t period;
+
+  // render side
+  uint32_t target_latency;
+  uint32_t margin;
+  uint32_t last_target;
+  bool queued;
+  uint32_t drops_in_row;
+  uint64_t last_drop;
+
+  // counters, reset by pacer_init
+  uint32_t presented;
+  uint32_t held;
+  uint32_t dropped;
+  uint64_t latency_total;
+  uint32_t latency_max;
+} frame_pacer;
+
+// period is the nominal refresh period, margin the time it takes to draw and
+// submit a frame
+void pacer_init(frame_pacer* pacer, uint32_t target_latency, uint32_t period, uint32_t margin);
+
+// called right after vblank number vcount started
+void pacer_vblank(frame_pacer* pacer, uint32_t vcount, uint64_t now);
+
+// Decide what to do with a frame that finished decoding at frame_time. For
+// PACER_HOLD the frame should be drawn at present_at, for PACER_PRESENT right
+// away.
+pacer_action pacer_decide(frame_pacer* pacer, uint64_t frame_time, uint64_t now, uint64_t* present_at);
+
+// true if the pacer had to drop a frame recently, safe to call from any thread
+bool pacer_overloaded(frame_pacer* pacer, uint64_t now);
+
+uint32_t pacer_average_latency(frame_pacer* pacer);
@@ -0,0 +1,116 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery.h"
+
+#include <string.h>
+
+// how long errors after lost frames are left to the RFI request
+#define RECOVERY_RFI_GRACE 500000
+// frames after a gap the host may have encoded before it got the RFI
+// request, about a round trip at 60 fps
+#define RECOVERY_RFI_FRAMES 6
+// interval between IDR requests, doubled per request
+#define RECOVERY_BACKOFF_MIN 100000
+#define RECOVERY_BACKOFF_MAX 2000000
+// an error this long after the last one starts over with the short interval
+#define RECOVERY_BACKOFF_RESET 5000000
+
+void recovery_init(recovery_state* state, bool rfi) {
+  memset(state, 0, sizeof(recovery_state));
+  state->status = RECOVERY_OK;
+  state->rfi = rfi;
+  state->backoff = RECOVERY_BACKOFF_MIN;
+}
+
+void recovery_frame(recovery_state* state, int frame_number, bool idr, uint64_t now) {
+  if (state->last_frame != 0 && frame_number != state->last_frame + 1) {
+    state->gaps++;
+    if (state->rfi && state->status != RECOVERY_WAIT_IDR) {
+      // another gap moves the point of recovery, not the deadline
+      if (state->status == RECOVERY_OK)
+        state->rfi_deadline = now + RECOVERY_RFI_GRACE;
+      state->status = RECOVERY_WAIT_RFI;
+      state->rfi_frame = frame_number + RECOVERY_RFI_FRAMES;
+    }
+  }
+  state->last_frame = frame_number;
+
+  if (idr)
+    state->status = RECOVERY_OK;
+  else if (state->status == RECOVERY_WAIT_RFI && now >= state->rfi_deadline)
+    state->status = RECOVERY_WAIT_IDR;
+}
+
+void recovery_decode_error(recovery_state* state, uint64_t now) {
+  state->errors++;
+
+  if (now - state->last_error > RECOVERY_BACKOFF_RESET)
+    state->backoff = RECOVERY_BACKOFF_MIN;
+  state->last_error = now;
+
+  // still within what the RFI request should fix
+  if (state->status == RECOVERY_WAIT_RFI && now < state->rfi_deadline)
+    return;
+  state->status = RECOVERY_WAIT_IDR;
+}
+
+void recovery_decode_ok(recovery_state* state) {
+  // frames before rfi_frame can decode fine and still show garbage
+  if (state->status == RECOVERY_WAIT_RFI && state->last_frame - state->rfi_frame >= 0)
+    state->status = RECOVERY_OK;
+}
+
+void recovery_frames_lost(recovery_state* state, uint64_t now) {
+  state->errors++;
+
+  if (now - state->last_error > RECOVERY_BACKOFF_RESET)
+    state->backoff = RECOVERY_BACKOFF_MIN;
+  state->last_error = now;
+  state->status = RECOVERY_WAIT_IDR;
+}
+
+void recovery_frames_skipped(recovery_state* state, uint32_t frames) {
+  if (state->last_frame != 0)
+    state->last_frame += frames;
+}
+
+bool recovery_need_idr(recovery_state* state, uint64_t now) {
+  if (state->status != RECOVERY_WAIT_IDR)
+    return false;
+
+  if (state->last_request != 0 && now - state->last_request < state->backoff) {
+    state->held_requests++;
+    return false;
+  }
+
+  state->last_request = now;
+  state->idr_requests++;
+  state->backoff *= 2;
+  if (state->backoff > RECOVERY_BACKOFF_MAX)
+    state->backoff = RECOVERY_BACKOFF_MAX;
+  return true;
+}
+
+bool recovery_presentable(recovery_state* state) {
+  if (state->status == RECOVERY_OK)
+    return true;
+  state->hidden_frames++;
+  return false;
+}
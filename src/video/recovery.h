@@ -0,0 +1,85 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2020 Michanne
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decides when the decoder asks the host for an IDR frame.
+//
+// A gap in the frame numbers means the depacketizer lost frames and has
+// already asked the host to recover, with reference frame invalidation (RFI)
+// when that is enabled. Frames the host encoded before it acted on the request
+// may still refer to the lost ones, and the decoder doesn't always fail on
+// them, so the stream only counts as clean again from a frame some way past
+// the gap or from an IDR frame. Decode errors until then are expected and
+// don't cause another request, unless RFI takes too long. Any other error puts
+// the stream into
+// recovery: frames are still decoded to keep the references going but not
+// presented, and IDR frames are requested with an interval that doubles for
+// every request until the stream is clean again.
+//
+// Times are in microseconds and passed in by the caller.
+
+typedef enum {
+  RECOVERY_OK,
+  // lost frames, the host was asked for RFI; a clean decode of rfi_frame or a
+  // later one recovers
+  RECOVERY_WAIT_RFI,
+  // only an IDR frame recovers
+  RECOVERY_WAIT_IDR,
+} recovery_status;
+
+typedef struct {
+  recovery_status status;
+  bool rfi;
+  int last_frame;
+  int rfi_frame;
+  uint64_t rfi_deadline;
+  uint64_t last_request;
+  uint64_t last_error;
+  uint32_t backoff;
+
+  // counters, reset by recovery_init
+  uint32_t gaps;
+  uint32_t errors;
+  uint32_t idr_requests;
+  uint32_t held_requests;
+  uint32_t hidden_frames;
+} recovery_state;
+
+void recovery_init(recovery_state* state, bool rfi);
+
+// a decode unit arrived, idr is set if it starts with an SPS
+void recovery_frame(recovery_state* state, int frame_number, bool idr, uint64_t now);
+void recovery_decode_error(recovery_state* state, uint64_t now);
+// the frame last passed to recovery_frame decoded without an error
+void recovery_decode_ok(recovery_state* state);
+// frames were thrown away on this side, the host doesn't know to recover
+void recovery_frames_lost(recovery_state* state, uint64_t now);
+// the frames right before the next one passed to recovery_frame were thrown
+// away on this side on purpose, their numbers aren't a gap
+void recovery_frames_skipped(recovery_state* state, uint32_t frames);
+
+// true if the host should be asked for an IDR frame now
+bool recovery_need_idr(recovery_state* state, uint64_t now);
+
+// true if the last decoded frame may be shown, counts it as hidden otherwise
+bool recovery_presentable(recovery_state* state);
@@ -18,9 +18,19 @@
  */
 
 #include "../video.h"
+#include "../audio/vita.h"
 #include "../config.h"
+#include "../connection.h"
 #include "../debug.h"
 #include "../gui/guilib.h"
+#include "../input/vita.h"
+#include "../media_queue.h"
+#include "au.h"
+#include "forensic.h"
+#include "frame_queue.h"
+#include "latency.h"
+#include "pacer.h"
+#include "recovery.h"
 #include "sps.h"
 
 #include <Limelight.h>
@@ -44,6 +54,7 @@
 
 void draw_streaming(vita2d_texture *frame_texture);
 void draw_fps();
+void draw_overlay();
 void draw_indicators();
 
 enum {
@@ -55,11 +66,25 @@ enum {
   VITA_VIDEO_ERROR_GET_MEMBASE          = 0x80010005,
   VITA_VIDEO_ERROR_CREATE_DEC           = 0x80010006,
   VITA_VIDEO_ERROR_CREATE_PACER_THREAD  = 0x80010007,
+  VITA_VIDEO_ERROR_CREATE_RENDER_THREAD = 0x80010008,
+  VITA_VIDEO_ERROR_CREATE_DECODE_THREAD = 0x80010009,
 };
 
-#define DECODER_BUFFER_SIZE (92 * 1024)
+#define DECODER_BUFFER_COUNT 1
+#define DECODER_REF_FRAMES 5
 
-static char* decoder_buffer = NULL;
+// time it takes the render thread to draw and submit a frame, in us
+#define FRAME_PACER_MARGIN 3000
+
+// decoder history is saved at most this often on errors, in us, and rotates
+// through this many files
+#define HISTORY_ERROR_INTERVAL 10000000
+#define HISTORY_ERROR_FILES 4
+
+// with the decode queue, every queued AU holds a slab and the decoder one more
+#define DECODE_QUEUE_SIZE (AU_POOL_MAX_SLABS - 1)
+
+static au_pool decoder_pool = {0};
 
 enum {
   SCREEN_WIDTH = 960,
@@ -73,19 +98,34 @@ enum VideoStatus {
   NOT_INIT,
   INIT_GS,
   INIT_FRAMEBUFFER,
-  INIT_AVC_LIB,
-  INIT_DECODER_MEMBLOCK,
   INIT_AVC_DEC,
   INIT_FRAME_PACER_THREAD,
+  INIT_RENDER_THREAD,
+  INIT_DECODE_THREAD,
 };
 
-vita2d_texture *frame_texture = NULL;
+vita2d_texture *frame_textures[FRAME_QUEUE_SIZE] = {0};
 enum VideoStatus video_status = NOT_INIT;
 
+// The decoder is not torn down with the rest of the video setup. It is kept
+// around and handed to the next session if that asks for the same mode, which
+// saves the library init and the large contiguous allocation.
+enum DecoderStatus {
+  DECODER_NOT_INIT,
+  DECODER_INIT_AVC_LIB,
+  DECODER_INIT_MEMBLOCK,
+  DECODER_INIT_AVC_DEC,
+};
+
+enum DecoderStatus decoder_status = DECODER_NOT_INIT;
+
 SceAvcdecCtrl *decoder = NULL;
 SceUID displayblock = -1;
 SceUID decoderblock = -1;
 SceUID pacer_thread = -1;
+SceUID render_thread = -1;
+SceUID render_sema = -1;
+SceUID decode_thread = -1;
 SceVideodecQueryInitInfoHwAvcdec *init = NULL;
 SceAvcdecQueryDecoderInfo *decoder_info = NULL;
 
@@ -98,12 +138,84 @@ typedef struct {
 static unsigned numframes;
 static bool active_video_thread = true;
 static bool active_pacer_thread = false;
+static bool active_render_thread = false;
+static bool active_decode_thread = false;
+static frame_queue render_queue;
 static indicator_status poor_net_indicator = {0};
 
 uint32_t frame_count = 0;
-uint32_t need_drop = 0;
 uint32_t curr_fps[2] = {0, 0};
-float carry = 0;
+// decoded frames replaced in the triple buffer before they were presented
+static uint32_t frames_skipped = 0;
+// non-reference frames not decoded at all while the pacer was dropping
+static uint32_t frames_predropped = 0;
+
+// per second numbers for the overlay, updated by the pacer thread
+static struct {
+  uint32_t generation;
+  uint32_t bitrate;
+  uint32_t au_average;
+  uint64_t last_bytes;
+  uint64_t last_frames;
+} stream_rate = {0};
+
+typedef struct {
+  int poor_periods;
+  uint64_t changed;
+} network_status;
+
+static network_status net_status = {0};
+
+#define OVERLAY_LINES 6
+#define OVERLAY_LINE_SIZE 96
+static char overlay_text[OVERLAY_LINES][OVERLAY_LINE_SIZE];
+static uint32_t overlay_generation = 0;
+
+// time a frame finished decoding and its number, per texture
+static uint64_t frame_times[FRAME_QUEUE_SIZE];
+static uint32_t frame_numbers[FRAME_QUEUE_SIZE];
+static frame_pacer pacer;
+static latency_ring latency;
+static recovery_state recovery;
+
+// Queued mode: the receive thread only assembles AUs and leaves decoding to
+// a thread of its own, so a slow decode never holds up the depacketizer.
+static bool queued_decode = false;
+static media_queue decode_queue;
+// AUs the decode thread never got to see although later frames need them
+static uint32_t frames_lost = 0;
+// AUs the receive thread threw away since the last one it queued
+static uint32_t frames_unqueued = 0;
+// set by the decode thread, reported to the host with the next decode unit
+static bool decode_idr_pending = false;
+
+// last decode units for post-mortem analysis, only touched by the thread
+// calling submitDecodeUnit; saving is requested through history_pending
+enum {
+  HISTORY_NONE,
+  HISTORY_ERROR,
+  HISTORY_REQUESTED,
+};
+
+static forensic_ring history;
+static int history_pending = HISTORY_NONE;
+static uint64_t history_saved = 0;
+static uint32_t history_files = 0;
+
+// what the connection set the video up with, reused when reconfiguring
+static struct {
+  int format;
+  int width;
+  int height;
+  int redraw_rate;
+  void* context;
+  int flags;
+} setup_params = {0};
+
+// time-to-first-frame of the current session
+static uint64_t setup_time = 0;
+static bool first_frame_pending = false;
+static bool decoder_reused = false;
 
 typedef struct {
   unsigned int texture_width;
@@ -184,73 +296,152 @@ void update_scaling_settings(int width, int height) {
 
 static int vita_pacer_thread_main(SceSize args, void *argp) {
   // 1s
-  int wait = 1000000;
-  //float max_fps = 0;
-  //sceDisplayGetRefreshRate(&max_fps);
-  //if (config.stream.fps == 30) {
-  //  max_fps /= 2;
-  //}
-  int max_fps = config.stream.fps;
-  uint64_t last_vblank_count = sceDisplayGetVcount();
-  uint64_t last_check_time = sceKernelGetSystemTimeWide();
-  //float carry = 0;
-  need_drop = 0;
+  uint32_t wait = 1000000;
+  uint32_t last_vblank_count = sceDisplayGetVcount();
+  uint64_t last_check_time = sceKernelGetProcessTimeWide();
+  bool grow_failed = false;
   frame_count = 0;
   while (active_pacer_thread) {
-    uint64_t curr_vblank_count = sceDisplayGetVcount();
-    uint32_t vblank_fps = curr_vblank_count - last_vblank_count;
-    uint32_t curr_frame_count = frame_count;
-    frame_count = 0;
-
-    if (!active_video_thread) {
-    //  carry = 0;
-    } else {
-      if (config.enable_frame_pacer && curr_frame_count > max_fps) {
-        //carry += curr_frame_count - max_fps;
-        //if (carry > 1) {
-        //  need_drop += (int)carry;
-        //  carry -= (int)carry;
-        //}
-        need_drop += curr_frame_count - max_fps;
+    sceDisplayWaitVblankStart();
+    uint64_t now = sceKernelGetProcessTimeWide();
+    uint32_t curr_vblank_count = sceDisplayGetVcount();
+    pacer_vblank(&pacer, curr_vblank_count, now);
+
+    // the receive thread never allocates, grow the AU slabs for it here
+    int grown = au_pool_maintain(&decoder_pool);
+    if (grown > 0) {
+      vita_debug_log("Video decode buffer grown to %u bytes (largest AU %u)\n",
+                     decoder_pool.slab_size, decoder_pool.largest_au);
+    } else if (grown < 0 && !grow_failed) {
+      vita_debug_log("Video decode buffer can't grow to %u bytes\n", decoder_pool.wanted_size);
+    }
+    grow_failed = grown < 0;
+
+    if (now - last_check_time >= wait) {
+      curr_fps[0] = frame_count;
+      curr_fps[1] = curr_vblank_count - last_vblank_count;
+      frame_count = 0;
+
+      uint64_t bytes = __atomic_load_n(&decoder_pool.bytes_total, __ATOMIC_RELAXED);
+      uint64_t frames = __atomic_load_n(&decoder_pool.frames, __ATOMIC_RELAXED);
+      if (frames >= stream_rate.last_frames) {
+        stream_rate.bitrate = (bytes - stream_rate.last_bytes) * 8 * 1000 / (now - last_check_time);
+        stream_rate.au_average = frames > stream_rate.last_frames ?
+          (bytes - stream_rate.last_bytes) / (frames - stream_rate.last_frames) : 0;
       }
-      //vita_debug_log("fps0/fps1/carry/need_drop: %u/%u/%f/%u\n",
-      //               curr_frame_count, vblank_fps, carry, need_drop);
+      stream_rate.last_bytes = bytes;
+      stream_rate.last_frames = frames;
+      __atomic_add_fetch(&stream_rate.generation, 1, __ATOMIC_RELEASE);
+
+      last_vblank_count = curr_vblank_count;
+      last_check_time = now;
     }
+  }
+  return 0;
+}
 
-    curr_fps[0] = curr_frame_count;
-    curr_fps[1] = vblank_fps;
+static int vita_render_thread_main(SceSize args, void *argp) {
+  // wake up now and then even without frames so cleanup isn't held up
+  SceUInt timeout = 100000;
+  while (active_render_thread) {
+    SceUInt wait = timeout;
+    sceKernelWaitSema(render_sema, 1, &wait);
 
-    last_vblank_count = curr_vblank_count;
-    uint64_t curr_check_time = sceKernelGetSystemTimeWide();
-    uint32_t lapse = curr_check_time - last_check_time;
-    last_check_time = curr_check_time;
-    if (lapse > wait && (lapse - wait) < wait) {
-      //vita_debug_log("sleep: %d", wait * 2 - lapse);
-      sceKernelDelayThread(wait * 2 - lapse);
-    } else {
-      sceKernelDelayThread(wait);
+    if (!frame_queue_acquire(&render_queue) || !active_video_thread) {
+      continue;
     }
+
+    int slot = frame_queue_present_slot(&render_queue);
+    if (config.enable_frame_pacer) {
+      uint64_t now = sceKernelGetProcessTimeWide();
+      uint64_t present_at;
+      pacer_action action = pacer_decide(&pacer, frame_times[slot], now, &present_at);
+      if (action == PACER_DROP) {
+        continue;
+      }
+      if (action == PACER_HOLD && present_at > now) {
+        sceKernelDelayThread(present_at - now);
+      }
+    }
+
+    vita2d_start_drawing();
+
+    draw_streaming(frame_textures[slot]);
+    draw_fps();
+    draw_overlay();
+    draw_indicators();
+
+    vita2d_end_drawing();
+
+    vita2d_wait_rendering_done();
+    latency_mark(&latency, frame_numbers[slot], LATENCY_DRAWN, sceKernelGetProcessTimeWide());
+    vita2d_swap_buffers();
+    uint64_t swapped = sceKernelGetProcessTimeWide();
+    latency_mark(&latency, frame_numbers[slot], LATENCY_SWAPPED, swapped);
+    media_clock_video_presented(&session_clock, latency_stamp(&latency, frame_numbers[slot], LATENCY_RECEIVED),
+                                swapped);
+
+    frame_count++;
   }
   return 0;
 }
 
-static void vita_cleanup() {
-  if (video_status == INIT_FRAME_PACER_THREAD) {
-    active_pacer_thread = false;
-    // wait 10sec
-    SceUInt timeout = 10000000;
-    int ret;
-    sceKernelWaitThreadEnd(pacer_thread, &ret, &timeout);
-    sceKernelDeleteThread(pacer_thread);
-    video_status--;
+static uint64_t vita_queue_clock() {
+  return sceKernelGetProcessTimeWide();
+}
+
+static void vita_queue_release(media_item* item) {
+  au_pool_release(&decoder_pool, item->handle);
+  if (!(item->flags & MEDIA_ITEM_DISPOSABLE)) {
+    __atomic_add_fetch(&frames_lost, 1, __ATOMIC_RELAXED);
   }
+}
 
-  if (video_status == INIT_AVC_DEC) {
+static bool vita_decode(au_frame* frame, int frame_number, uint64_t now);
+
+static int vita_decode_thread_main(SceSize args, void *argp) {
+  // wake up now and then even without frames so cleanup isn't held up
+  SceUInt timeout = 100000;
+  uint32_t lost = 0;
+  while (active_decode_thread) {
+    media_item item;
+    if (!media_queue_pop(&decode_queue, &item, NULL, timeout)) {
+      continue;
+    }
+
+    uint64_t now = sceKernelGetProcessTimeWide();
+    bool idr = (item.flags & MEDIA_ITEM_KEY) != 0;
+    // frames thrown away before this one aren't lost in the network, the
+    // host has nothing to recover for them
+    recovery_frames_skipped(&recovery, item.dropped);
+    recovery_frame(&recovery, item.number, idr, now);
+
+    // the queue threw away frames this one may refer to
+    uint32_t lost_now = __atomic_load_n(&frames_lost, __ATOMIC_RELAXED);
+    if (lost_now != lost && !idr) {
+      recovery_frames_lost(&recovery, now);
+    }
+    lost = lost_now;
+
+    au_frame frame = {
+      .data = item.data,
+      .length = item.length,
+      .slab = item.handle,
+    };
+    if (vita_decode(&frame, item.number, now)) {
+      __atomic_store_n(&decode_idr_pending, true, __ATOMIC_RELEASE);
+    }
+  }
+  return 0;
+}
+
+static void vita_decoder_close() {
+  if (decoder_status == DECODER_INIT_AVC_DEC) {
     sceAvcdecDeleteDecoder(decoder);
-    video_status--;
+    decoder_status--;
   }
 
-  if (video_status == INIT_DECODER_MEMBLOCK) {
+  if (decoder_status == DECODER_INIT_MEMBLOCK) {
     if (decoderblock >= 0) {
       sceKernelFreeMemBlock(decoderblock);
       decoderblock = -1;
@@ -263,71 +454,38 @@ static void vita_cleanup() {
       free(decoder_info);
       decoder_info = NULL;
     }
-    video_status--;
+    decoder_status--;
   }
 
-  if (video_status == INIT_AVC_LIB) {
+  if (decoder_status == DECODER_INIT_AVC_LIB) {
     sceVideodecTermLibrary(SCE_VIDEODEC_TYPE_HW_AVCDEC);
 
     if (init != NULL) {
       free(init);
       init = NULL;
     }
-    video_status--;
-  }
-
-  if (video_status == INIT_FRAMEBUFFER) {
-    if (frame_texture != NULL) {
-      vita2d_free_texture(frame_texture);
-      frame_texture = NULL;
-    }
-
-    if (decoder_buffer != NULL) {
-      free(decoder_buffer);
-      decoder_buffer = NULL;
-    }
-    video_status--;
-  }
-
-  if (video_status == INIT_GS) {
-    gs_sps_stop();
-    video_status--;
+    decoder_status--;
   }
 }
 
-static int vita_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+static int vita_decoder_open(uint32_t horizontal, uint32_t vertical) {
   int ret;
-  printf("vita video setup\n");
 
-  if (video_status == NOT_INIT) {
-    // INIT_GS
-    gs_sps_init(width, height);
-    video_status++;
-  }
-
-  if (video_status == INIT_GS) {
-    // INIT_FRAMEBUFFER
-    update_scaling_settings(width, height);
-
-    decoder_buffer = malloc(DECODER_BUFFER_SIZE);
-    if (decoder_buffer == NULL) {
-      printf("not enough memory\n");
-      ret = VITA_VIDEO_ERROR_NO_MEM;
-      goto cleanup;
-    }
-
-    frame_texture = vita2d_create_empty_texture_format(image_scaling.texture_width, image_scaling.texture_height, SCE_GXM_TEXTURE_FORMAT_U8U8U8U8_ABGR);
-    if (frame_texture == NULL) {
-      printf("not enough memory\n");
-      ret = VITA_VIDEO_ERROR_NO_MEM;
-      goto cleanup;
+  if (decoder_status == DECODER_INIT_AVC_DEC) {
+    if (init->horizontal == horizontal && init->vertical == vertical &&
+        init->numOfRefFrames == DECODER_REF_FRAMES) {
+      vita_debug_log("reusing decoder %ux%u\n", horizontal, vertical);
+      decoder_reused = true;
+      return VITA_VIDEO_INIT_OK;
     }
-
-    video_status++;
+    vita_debug_log("decoder %ux%u doesn't match, recreating\n", init->horizontal, init->vertical);
+    vita_decoder_close();
   }
+  decoder_reused = false;
+  uint64_t start = sceKernelGetProcessTimeWide();
 
-  if (video_status == INIT_FRAMEBUFFER) {
-    // INIT_AVC_LIB
+  if (decoder_status == DECODER_NOT_INIT) {
+    // DECODER_INIT_AVC_LIB
     if (init == NULL) {
       init = calloc(1, sizeof(SceVideodecQueryInitInfoHwAvcdec));
       if (init == NULL) {
@@ -337,9 +495,9 @@ static int vita_setup(int videoFormat, int width, int height, int redrawRate, vo
       }
     }
     init->size = sizeof(SceVideodecQueryInitInfoHwAvcdec);
-    init->horizontal = VITA_DECODER_RESOLUTION(width);
-    init->vertical = VITA_DECODER_RESOLUTION(height);
-    init->numOfRefFrames = 5;
+    init->horizontal = horizontal;
+    init->vertical = vertical;
+    init->numOfRefFrames = DECODER_REF_FRAMES;
     init->numOfStreams = 1;
 
     ret = sceVideodecInitLibrary(SCE_VIDEODEC_TYPE_HW_AVCDEC, init);
@@ -348,11 +506,11 @@ static int vita_setup(int videoFormat, int width, int height, int redrawRate, vo
       ret = VITA_VIDEO_ERROR_INIT_LIB;
       goto cleanup;
     }
-    video_status++;
+    decoder_status++;
   }
 
-  if (video_status == INIT_AVC_LIB) {
-    // INIT_DECODER_MEMBLOCK
+  if (decoder_status == DECODER_INIT_AVC_LIB) {
+    // DECODER_INIT_MEMBLOCK
     if (decoder_info == NULL) {
       decoder_info = calloc(1, sizeof(SceAvcdecQueryDecoderInfo));
       if (decoder_info == NULL) {
@@ -398,11 +556,11 @@ static int vita_setup(int videoFormat, int width, int height, int redrawRate, vo
       ret = VITA_VIDEO_ERROR_GET_MEMBASE;
       goto cleanup;
     }
-    video_status++;
+    decoder_status++;
   }
 
-  if (video_status == INIT_DECODER_MEMBLOCK) {
-    // INIT_AVC_DEC
+  if (decoder_status == DECODER_INIT_MEMBLOCK) {
+    // DECODER_INIT_AVC_DEC
     printf("base: 0x%08x\n", decoder->frameBuf.pBuf);
 
     ret = sceAvcdecCreateDecoder(SCE_VIDEODEC_TYPE_HW_AVCDEC, decoder, decoder_info);
@@ -411,11 +569,194 @@ static int vita_setup(int videoFormat, int width, int height, int redrawRate, vo
       ret = VITA_VIDEO_ERROR_CREATE_DEC;
       goto cleanup;
     }
+    decoder_status++;
+  }
+
+  vita_debug_log("decoder %ux%u created in %llu us\n", horizontal, vertical,
+                 sceKernelGetProcessTimeWide() - start);
+  return VITA_VIDEO_INIT_OK;
+
+cleanup:
+  vita_decoder_close();
+  return ret;
+}
+
+// walk the setup back down until only the stages up to target are left
+static void vita_teardown(enum VideoStatus target) {
+  if (video_status == INIT_DECODE_THREAD && video_status > target) {
+    if (queued_decode) {
+      active_decode_thread = false;
+      // wait 10sec
+      SceUInt timeout = 10000000;
+      int ret;
+      sceKernelWaitThreadEnd(decode_thread, &ret, &timeout);
+      sceKernelDeleteThread(decode_thread);
+
+      vita_debug_log("decode queue: %u queued, depth avg %u.%02u max %d, dropped %u full %u stale (%u needed), %u frames lost\n",
+                     decode_queue.pushed, media_queue_average_depth(&decode_queue) / 100,
+                     media_queue_average_depth(&decode_queue) % 100, decode_queue.max_depth,
+                     decode_queue.dropped_full, decode_queue.dropped_age,
+                     decode_queue.dropped_required, frames_lost);
+      // hands the slabs still queued back to the pool
+      media_queue_destroy(&decode_queue);
+    }
+    video_status--;
+  }
+
+  if (video_status == INIT_RENDER_THREAD && video_status > target) {
+    active_render_thread = false;
+    // wait 10sec
+    SceUInt timeout = 10000000;
+    int ret;
+    sceKernelWaitThreadEnd(render_thread, &ret, &timeout);
+    sceKernelDeleteThread(render_thread);
+    sceKernelDeleteSema(render_sema);
+    render_sema = -1;
+
+    static const char* stage_names[LATENCY_STAGES] = {"total", "queue", "decode", "draw", "swap"};
+    latency_percentiles stats[LATENCY_STAGES];
+    latency_summary(&latency, stats);
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+      vita_debug_log("latency %s: p50 %u p95 %u p99 %u us (%u frames)\n", stage_names[i],
+                     stats[i].p50, stats[i].p95, stats[i].p99, stats[i].samples);
+    }
+    video_status--;
+  }
+
+  if (video_status == INIT_FRAME_PACER_THREAD && video_status > target) {
+    active_pacer_thread = false;
+    // wait 10sec
+    SceUInt timeout = 10000000;
+    int ret;
+    sceKernelWaitThreadEnd(pacer_thread, &ret, &timeout);
+    sceKernelDeleteThread(pacer_thread);
+
+    vita_debug_log("pacer: %u presented, %u held, %u dropped, %u not decoded, latency avg %u max %u us, vblank %u us\n",
+                   pacer.presented, pacer.held, pacer.dropped, frames_predropped,
+                   pacer_average_latency(&pacer), pacer.latency_max, pacer.period);
+    video_status--;
+  }
+
+  if (video_status == INIT_AVC_DEC && video_status > target) {
+    // the decoder stays open for the next session, see vita_decoder_open
+    video_status--;
+  }
+
+  if (video_status == INIT_FRAMEBUFFER && video_status > target) {
+    for (int i = 0; i < FRAME_QUEUE_SIZE; i++) {
+      if (frame_textures[i] != NULL) {
+        vita2d_free_texture(frame_textures[i]);
+        frame_textures[i] = NULL;
+      }
+    }
+
+    vita_debug_log("au pool: %llu frames, %llu zero-copy, %llu/%llu bytes copied\n",
+                   decoder_pool.frames, decoder_pool.zero_copy_frames,
+                   decoder_pool.bytes_copied, decoder_pool.bytes_total);
+    vita_debug_log("au pool: largest %u, average %u, slab %u, %u resizes, %u oversized\n",
+                   decoder_pool.largest_au, au_pool_average(&decoder_pool),
+                   decoder_pool.slab_size, decoder_pool.resizes, decoder_pool.oversized);
+    vita_debug_log("recovery: %u gaps, %u decode errors, %u IDR requests, %u held back, %u frames hidden\n",
+                   recovery.gaps, recovery.errors, recovery.idr_requests,
+                   recovery.held_requests, recovery.hidden_frames);
+    if (decoder_pool.frames > 0) {
+      vita_debug_log("au pool: %llu slices, %llu.%02llu per frame\n", decoder_pool.slices,
+                     decoder_pool.slices / decoder_pool.frames,
+                     decoder_pool.slices * 100 / decoder_pool.frames % 100);
+    }
+    vita_debug_log("decoder history: %u frames, %u evicted, %u too large, saved %u times\n",
+                   history.recorded, history.evicted, history.oversized, history.flushes);
+    au_pool_destroy(&decoder_pool);
+    forensic_destroy(&history);
+    video_status--;
+  }
+
+  if (video_status == INIT_GS && video_status > target) {
+    gs_sps_stop();
+    video_status--;
+  }
+}
+
+static void vita_cleanup() {
+  vita_teardown(NOT_INIT);
+}
+
+static int vita_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  int ret;
+  printf("vita video setup\n");
+  setup_params.format = videoFormat;
+  setup_params.width = width;
+  setup_params.height = height;
+  setup_params.redraw_rate = redrawRate;
+  setup_params.context = context;
+  setup_params.flags = drFlags;
+  setup_time = sceKernelGetProcessTimeWide();
+  first_frame_pending = true;
+  if (video_status == NOT_INIT) {
+    queued_decode = config.enable_decode_queue;
+  }
+
+  if (video_status == NOT_INIT) {
+    // INIT_GS
+    gs_sps_init(width, height);
+    video_status++;
+  }
+
+  if (video_status == INIT_GS) {
+    // INIT_FRAMEBUFFER
+    update_scaling_settings(width, height);
+
+    uint32_t buffer_size = au_estimate_size(config.stream.bitrate, width, height, redrawRate);
+    vita_debug_log("decoder buffer size %u for %d kbps %dx%d@%d\n",
+                   buffer_size, config.stream.bitrate, width, height, redrawRate);
+    if (au_pool_init(&decoder_pool, queued_decode ? AU_POOL_MAX_SLABS : DECODER_BUFFER_COUNT, buffer_size) < 0) {
+      printf("not enough memory\n");
+      ret = VITA_VIDEO_ERROR_NO_MEM;
+      goto cleanup;
+    }
+    // queued AUs outlive the decode unit they came from
+    decoder_pool.zero_copy = !queued_decode;
+
+    for (int i = 0; i < FRAME_QUEUE_SIZE; i++) {
+      frame_textures[i] = vita2d_create_empty_texture_format(image_scaling.texture_width, image_scaling.texture_height, SCE_GXM_TEXTURE_FORMAT_U8U8U8U8_ABGR);
+      if (frame_textures[i] == NULL) {
+        printf("not enough memory\n");
+        ret = VITA_VIDEO_ERROR_NO_MEM;
+        goto cleanup;
+      }
+    }
+    if (forensic_init(&history, setup_params.format, width, height, redrawRate) < 0) {
+      vita_debug_log("not enough memory for the decoder history\n");
+    }
+    history_pending = HISTORY_NONE;
+
+    frame_queue_init(&render_queue);
+    latency_ring_init(&latency);
+    recovery_init(&recovery, config.enable_ref_frame_invalidation);
+    frames_skipped = 0;
+    frames_predropped = 0;
+    memset(&stream_rate, 0, sizeof(stream_rate));
+
+    video_status++;
+  }
+
+  if (video_status == INIT_FRAMEBUFFER) {
+    // INIT_AVC_DEC
+    ret = vita_decoder_open(VITA_DECODER_RESOLUTION(width), VITA_DECODER_RESOLUTION(height));
+    if (ret < 0) {
+      goto cleanup;
+    }
     video_status++;
   }
 
   if (video_status == INIT_AVC_DEC) {
     // INIT_FRAME_PACER_THREAD
+    float refresh_rate = 0;
+    if (sceDisplayGetRefreshRate(&refresh_rate) < 0 || refresh_rate < 1) {
+      refresh_rate = 59.94005f;
+    }
+    pacer_init(&pacer, config.frame_pacer_latency * 1000, 1000000 / refresh_rate, FRAME_PACER_MARGIN);
+
     ret = sceKernelCreateThread("frame_pacer", vita_pacer_thread_main, 0, 0x10000, 0, 0, NULL);
     if (ret < 0) {
       printf("sceKernelCreateThread 0x%x\n", ret);
@@ -428,6 +769,56 @@ static int vita_setup(int videoFormat, int width, int height, int redrawRate, vo
     video_status++;
   }
 
+  if (video_status == INIT_FRAME_PACER_THREAD) {
+    // INIT_RENDER_THREAD
+    render_sema = sceKernelCreateSema("render_sema", 0, 0, 1, NULL);
+    if (render_sema < 0) {
+      printf("sceKernelCreateSema 0x%x\n", render_sema);
+      ret = VITA_VIDEO_ERROR_CREATE_RENDER_THREAD;
+      goto cleanup;
+    }
+
+    ret = sceKernelCreateThread("video_render", vita_render_thread_main, 0, 0x10000, 0, 0, NULL);
+    if (ret < 0) {
+      printf("sceKernelCreateThread 0x%x\n", ret);
+      sceKernelDeleteSema(render_sema);
+      render_sema = -1;
+      ret = VITA_VIDEO_ERROR_CREATE_RENDER_THREAD;
+      goto cleanup;
+    }
+    render_thread = ret;
+    active_render_thread = true;
+    sceKernelStartThread(render_thread, 0, NULL);
+    video_status++;
+  }
+
+  if (video_status == INIT_RENDER_THREAD) {
+    // INIT_DECODE_THREAD
+    if (queued_decode) {
+      frames_lost = 0;
+      frames_unqueued = 0;
+      decode_idr_pending = false;
+      if (media_queue_init(&decode_queue, "decode_queue", DECODE_QUEUE_SIZE, 0,
+                           config.decode_queue_age * 1000, vita_queue_release, vita_queue_clock) < 0) {
+        printf("media_queue_init failed\n");
+        ret = VITA_VIDEO_ERROR_CREATE_DECODE_THREAD;
+        goto cleanup;
+      }
+
+      ret = sceKernelCreateThread("video_decode", vita_decode_thread_main, 0, 0x10000, 0, 0, NULL);
+      if (ret < 0) {
+        printf("sceKernelCreateThread 0x%x\n", ret);
+        media_queue_destroy(&decode_queue);
+        ret = VITA_VIDEO_ERROR_CREATE_DECODE_THREAD;
+        goto cleanup;
+      }
+      decode_thread = ret;
+      active_decode_thread = true;
+      sceKernelStartThread(decode_thread, 0, NULL);
+    }
+    video_status++;
+  }
+
   return VITA_VIDEO_INIT_OK;
 
 cleanup:
@@ -435,7 +826,29 @@ cleanup:
   return ret;
 }
 
-static int vita_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+// The host changed the resolution mid-stream. Only the stages that depend on
+// it are rebuilt: textures, decoder and the threads using them. The
+// connection and the SPS state are left alone.
+static int vita_reconfigure(int width, int height) {
+  vita_debug_log("stream changed to %dx%d, reconfiguring video\n", width, height);
+  uint64_t start = sceKernelGetProcessTimeWide();
+
+  vita_teardown(INIT_GS);
+  int ret = vita_setup(setup_params.format, width, height, setup_params.redraw_rate,
+                       setup_params.context, setup_params.flags);
+  if (ret < 0) {
+    vita_debug_log("video reconfiguration failed: 0x%x\n", ret);
+    return ret;
+  }
+
+  vita_debug_log("video reconfigured in %llu us\n", sceKernelGetProcessTimeWide() - start);
+  return ret;
+}
+
+// Decode an assembled AU into the write slot and hand it to the render
+// thread. Releases the AU. Returns true if the host should be asked for an
+// IDR frame.
+static bool vita_decode(au_frame* frame, int frame_number, uint64_t now) {
   SceAvcdecAu au = {0};
   SceAvcdecArrayPicture array_picture = {0};
   struct SceAvcdecPicture picture = {0};
@@ -443,76 +856,167 @@ static int vita_submit_decode_unit(PDECODE_UNIT decodeUnit) {
   array_picture.numOfElm = 1;
   array_picture.pPicture = &pictures;
 
-  //frame->time = decodeUnit->receiveTimeMs;
-
   picture.size = sizeof(picture);
   picture.frame.pixelType = 0;
   picture.frame.framePitch = image_scaling.texture_width;
   picture.frame.frameWidth = image_scaling.texture_width;
   picture.frame.frameHeight = image_scaling.texture_height;
-  picture.frame.pPicture[0] = vita2d_texture_get_datap(frame_texture);
+  picture.frame.pPicture[0] = vita2d_texture_get_datap(frame_textures[frame_queue_write_slot(&render_queue)]);
 
-  if (decodeUnit->fullLength >= DECODER_BUFFER_SIZE) {
-    printf("Video decode buffer too small\n");
-    exit(1);
-  }
-
-  PLENTRY entry = decodeUnit->bufferList;
-  uint32_t length = 0;
-  while (entry != NULL) {
-    if (entry->bufferType == BUFFER_TYPE_SPS) {
-      gs_sps_fix(entry, GS_SPS_BITSTREAM_FIXUP, decoder_buffer, &length);
-    } else {
-      memcpy(decoder_buffer+length, entry->data, entry->length);
-      length += entry->length;
-    }
-    entry = entry->next;
-  }
-
-  au.es.pBuf = decoder_buffer;
-  au.es.size = decodeUnit->fullLength;
+  au.es.pBuf = (void*) frame->data;
+  au.es.size = frame->length;
   au.dts.lower = 0xFFFFFFFF;
   au.dts.upper = 0xFFFFFFFF;
   au.pts.lower = 0xFFFFFFFF;
   au.pts.upper = 0xFFFFFFFF;
 
+  latency_mark(&latency, frame_number, LATENCY_SUBMITTED, sceKernelGetProcessTimeWide());
+
   int ret = 0;
   ret = sceAvcdecDecode(decoder, &au, &array_picture);
+  au_frame_release(&decoder_pool, frame);
   if (ret < 0) {
-    printf("sceAvcdecDecode (len=0x%x): 0x%x numOfOutput %d\n", decodeUnit->fullLength, ret, array_picture.numOfOutput);
-    return DR_NEED_IDR;
+    printf("sceAvcdecDecode (len=0x%x): 0x%x numOfOutput %d\n", frame->length, ret, array_picture.numOfOutput);
+    int expected = HISTORY_NONE;
+    __atomic_compare_exchange_n(&history_pending, &expected, HISTORY_ERROR, false,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    recovery_decode_error(&recovery, now);
+    return recovery_need_idr(&recovery, now);
   }
+  recovery_decode_ok(&recovery);
 
   if (array_picture.numOfOutput != 1) {
     //printf("numOfOutput %d\n", array_picture.numOfOutput);
+    return recovery_need_idr(&recovery, now);
+  }
+
+  // decoded against lost references, keep showing the last good frame
+  if (!recovery_presentable(&recovery)) {
+    return recovery_need_idr(&recovery, now);
+  }
+
+  // the render thread presents it, the next frame decodes into another texture
+  int slot = frame_queue_write_slot(&render_queue);
+  frame_times[slot] = sceKernelGetProcessTimeWide();
+  frame_numbers[slot] = frame_number;
+  latency_mark(&latency, frame_number, LATENCY_DECODED, frame_times[slot]);
+  if (first_frame_pending) {
+    first_frame_pending = false;
+    vita_debug_log("first frame %llu us after setup (%s decoder)\n",
+                   frame_times[slot] - setup_time, decoder_reused ? "reused" : "new");
+  }
+  if (frame_queue_publish(&render_queue)) {
+    frames_skipped++;
+  }
+  sceKernelSignalSema(render_sema, 1);
+
+  // if (numframes++ % 6 == 0)
+  //   return true;
+
+  return recovery_need_idr(&recovery, now);
+}
+
+static void vita_save_history(int reason, uint64_t now) {
+  char path[256];
+  if (reason == HISTORY_ERROR) {
+    // an error storm would otherwise write a file for every frame
+    if (history_saved != 0 && now - history_saved < HISTORY_ERROR_INTERVAL) {
+      return;
+    }
+    snprintf(path, sizeof(path), "%s/decode_error_%u.cap", config.decoder_history_dir,
+             history_files++ % HISTORY_ERROR_FILES);
+  } else {
+    snprintf(path, sizeof(path), "%s/decode_history.cap", config.decoder_history_dir);
+  }
+  history_saved = now;
+
+  int count = forensic_flush(&history, path);
+  if (count < 0) {
+    vita_debug_log("can't write decoder history to %s\n", path);
+  } else {
+    vita_debug_log("decoder history: %d frames written to %s\n", count, path);
+  }
+}
+
+static int vita_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  // nothing to decode into after a failed reconfiguration
+  if (video_status != INIT_DECODE_THREAD) {
     return DR_OK;
   }
 
-  if (active_video_thread) {
-    if (need_drop > 0) {
-      vita_debug_log("remain frameskip: %d\n", need_drop);
-      // skip
-      need_drop--;
-    } else {
-      vita2d_start_drawing();
-      
-      draw_streaming(frame_texture);
-      draw_fps();
-      draw_indicators();
-      
-      vita2d_end_drawing();
+  uint64_t now = sceKernelGetProcessTimeWide();
+  bool idr = decodeUnit->bufferList != NULL && decodeUnit->bufferList->bufferType == BUFFER_TYPE_SPS;
+
+  // the host switched modes, rebuild the decoder and textures for the new
+  // one; the decoder doesn't depend on the level, a change of that alone
+  // needs nothing
+  int width, height;
+  if (idr && gs_sps_changed(decodeUnit->bufferList, &width, &height) &&
+      (width != setup_params.width || height != setup_params.height)) {
+    if (vita_reconfigure(width, height) < 0) {
+      // nothing left to decode into, the UI ends the session
+      connection_abort("the video decoder can't be set up for the new resolution");
+      return DR_OK;
+    }
+  }
 
-      vita2d_wait_rendering_done();
-      vita2d_swap_buffers();
+  // the connection clock is the process time in ms
+  latency_begin(&latency, decodeUnit->frameNumber, decodeUnit->receiveTimeMs * 1000);
+  forensic_record(&history, decodeUnit, decodeUnit->receiveTimeMs * 1000);
+  int history_reason = __atomic_exchange_n(&history_pending, HISTORY_NONE, __ATOMIC_ACQUIRE);
+  if (history_reason != HISTORY_NONE) {
+    vita_save_history(history_reason, now);
+  }
+  // in queued mode the decode thread owns the recovery state
+  if (!queued_decode) {
+    recovery_frame(&recovery, decodeUnit->frameNumber, idr, now);
+  }
 
-      frame_count++;
+  // the pacer is throwing frames away, start with the ones nothing refers to
+  bool overloaded = config.enable_frame_pacer && pacer_overloaded(&pacer, now);
+  bool disposable = (overloaded || queued_decode) && au_is_disposable(decodeUnit);
+  if (overloaded && disposable) {
+    frames_predropped++;
+    // direct mode saw it in recovery_frame already
+    if (queued_decode) {
+      frames_unqueued++;
     }
+    return DR_OK;
   }
 
-  // if (numframes++ % 6 == 0)
-  //   return DR_NEED_IDR;
+  if (queued_decode) {
+    // the AU needs a slab, the queued ones hold on to theirs
+    media_queue_make_room(&decode_queue);
+  }
+
+  au_frame frame;
+  if (!au_assemble(&decoder_pool, decodeUnit, GS_SPS_BITSTREAM_FIXUP, &frame)) {
+    vita_debug_log("Video decode buffer unavailable for %d bytes\n", decodeUnit->fullLength);
+    if (queued_decode) {
+      __atomic_add_fetch(&frames_lost, 1, __ATOMIC_RELAXED);
+      frames_unqueued++;
+      return DR_OK;
+    }
+    recovery_decode_error(&recovery, now);
+    return recovery_need_idr(&recovery, now) ? DR_NEED_IDR : DR_OK;
+  }
 
-  return DR_OK;
+  if (queued_decode) {
+    media_item item = {
+      .data = (void*) frame.data,
+      .length = frame.length,
+      .handle = frame.slab,
+      .number = decodeUnit->frameNumber,
+      .flags = (idr ? MEDIA_ITEM_KEY : 0) | (disposable ? MEDIA_ITEM_DISPOSABLE : 0),
+      .arrival = now,
+      .dropped = frames_unqueued,
+    };
+    frames_unqueued = 0;
+    media_queue_push(&decode_queue, &item);
+    return __atomic_exchange_n(&decode_idr_pending, false, __ATOMIC_ACQ_REL) ? DR_NEED_IDR : DR_OK;
+  }
+
+  return vita_decode(&frame, decodeUnit->frameNumber, now) ? DR_NEED_IDR : DR_OK;
 }
 
 void draw_streaming(vita2d_texture *frame_texture) {
@@ -528,8 +1032,69 @@ void draw_streaming(vita2d_texture *frame_texture) {
 }
 
 void draw_fps() {
-  if (config.show_fps) {
-    vita2d_font_draw_textf(font, 40, 20, RGBA8(0xFF, 0xFF, 0xFF, 0xFF), 16, "fps: %u / %u", curr_fps[0], curr_fps[1]);
+  if (config.show_fps && !config.show_overlay) {
+    vita2d_font_draw_textf(font, 40, 20, RGBA8(0xFF, 0xFF, 0xFF, 0xFF), 16, "fps: %u / %u  A/V %+d ms",
+                           curr_fps[0], curr_fps[1], media_clock_av_offset(&session_clock) / 1000);
+  }
+}
+
+#define OVERLAY_MS(us) (us) / 1000, (us) / 100 % 10
+
+static void update_overlay() {
+  latency_percentiles stats[LATENCY_STAGES];
+  latency_summary(&latency, stats);
+
+  snprintf(overlay_text[0], OVERLAY_LINE_SIZE, "fps %u / %u  held %u  dropped %u+%u  skipped %u",
+           curr_fps[0], curr_fps[1], pacer.held, pacer.dropped, frames_predropped, frames_skipped);
+  snprintf(overlay_text[1], OVERLAY_LINE_SIZE, "latency %u.%u / %u.%u / %u.%u ms (p50/p95/p99)  A/V %+d ms  drift %+d ppm",
+           OVERLAY_MS(stats[LATENCY_RECEIVED].p50), OVERLAY_MS(stats[LATENCY_RECEIVED].p95),
+           OVERLAY_MS(stats[LATENCY_RECEIVED].p99), media_clock_av_offset(&session_clock) / 1000,
+           media_clock_drift(&session_clock));
+  snprintf(overlay_text[2], OVERLAY_LINE_SIZE, "queue %u.%u  decode %u.%u / %u.%u  draw %u.%u  swap %u.%u ms",
+           OVERLAY_MS(stats[LATENCY_SUBMITTED].p50), OVERLAY_MS(stats[LATENCY_DECODED].p50),
+           OVERLAY_MS(stats[LATENCY_DECODED].p99), OVERLAY_MS(stats[LATENCY_DRAWN].p50),
+           OVERLAY_MS(stats[LATENCY_SWAPPED].p50));
+  uint32_t input_average, input_max;
+  vitainput_latency_stats(&input_average, &input_max);
+  snprintf(overlay_text[3], OVERLAY_LINE_SIZE, "%u kbps  AU avg %u KB  largest %u KB  input %u.%u / %u.%u ms",
+           stream_rate.bitrate, stream_rate.au_average / 1024, decoder_pool.largest_au / 1024,
+           OVERLAY_MS(input_average), OVERLAY_MS(input_max));
+  int audio_target;
+  uint32_t underruns, overruns;
+  vitaaudio_jitter_stats(&audio_target, &underruns, &overruns);
+  int length = snprintf(overlay_text[4], OVERLAY_LINE_SIZE, "audio %d ms (target %d) under %u over %u",
+                        vitaaudio_queued_samples() / 48, audio_target / 48, underruns, overruns);
+  if (queued_decode && length < OVERLAY_LINE_SIZE) {
+    snprintf(overlay_text[4] + length, OVERLAY_LINE_SIZE - length, "  queue %d (avg %u.%02u) dropped %u",
+             media_queue_depth(&decode_queue), media_queue_average_depth(&decode_queue) / 100,
+             media_queue_average_depth(&decode_queue) % 100,
+             decode_queue.dropped_full + decode_queue.dropped_age);
+  }
+
+  if (net_status.poor_periods == 0) {
+    snprintf(overlay_text[5], OVERLAY_LINE_SIZE, "network okay");
+  } else {
+    snprintf(overlay_text[5], OVERLAY_LINE_SIZE, "network %s for %llu s, %d poor periods",
+             poor_net_indicator.activated ? "poor" : "okay",
+             (sceKernelGetProcessTimeWide() - net_status.changed) / 1000000, net_status.poor_periods);
+  }
+}
+
+void draw_overlay() {
+  if (!config.show_overlay) {
+    return;
+  }
+
+  // text only changes once a second, don't format it on every frame
+  uint32_t generation = __atomic_load_n(&stream_rate.generation, __ATOMIC_ACQUIRE);
+  if (generation != overlay_generation) {
+    overlay_generation = generation;
+    update_overlay();
+  }
+
+  vita2d_draw_rectangle(30, 4, 420, OVERLAY_LINES * 20 + 8, RGBA8(0, 0, 0, 0x80));
+  for (int i = 0; i < OVERLAY_LINES; i++) {
+    vita2d_font_draw_text(font, 40, 20 + i * 20, RGBA8(0xFF, 0xFF, 0xFF, 0xFF), 16, overlay_text[i]);
   }
 }
 
@@ -555,14 +1120,33 @@ void vitavideo_stop() {
 }
 
 void vitavideo_show_poor_net_indicator() {
+  if (!poor_net_indicator.activated) {
+    net_status.poor_periods++;
+    net_status.changed = sceKernelGetProcessTimeWide();
+  }
   poor_net_indicator.activated = true;
 }
 
 void vitavideo_hide_poor_net_indicator() {
+  if (poor_net_indicator.activated) {
+    net_status.changed = sceKernelGetProcessTimeWide();
+  }
   //poor_net_indicator.activated = false;
   memset(&poor_net_indicator, 0, sizeof(indicator_status));
 }
 
+void vitavideo_save_history() {
+  // written by the thread that records it, with the next decode unit
+  __atomic_store_n(&history_pending, HISTORY_REQUESTED, __ATOMIC_RELEASE);
+}
+
+void vitavideo_warmup(int width, int height) {
+  // only while no session owns the decoder
+  if (video_status == NOT_INIT) {
+    vita_decoder_open(VITA_DECODER_RESOLUTION(width), VITA_DECODER_RESOLUTION(height));
+  }
+}
+
 DECODER_RENDERER_CALLBACKS decoder_callbacks_vita = {
   .setup = vita_setup,
   .cleanup = vita_cleanup,